@@ -42,7 +42,7 @@ public:
     static void init(Button *button, KDecoration2::DecoratedClient *decoratedClient) {
         QObject::connect(decoratedClient, &KDecoration2::DecoratedClient::iconChanged,
             button, [button] {
-                button->update();
+                button->scheduleRepaint();
             }
         );
     }
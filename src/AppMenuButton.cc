@@ -27,9 +27,6 @@
 // KDecoration
 #include <KDecoration2/DecoratedClient>
 
-// KF
-#include <KColorUtils>
-
 // Qt
 #include <QDebug>
 
@@ -85,10 +82,7 @@ QColor AppMenuButton::foregroundColor() const
         if (!deco) {
             return {};
         }
-        return KColorUtils::mix(
-            deco->titleBarBackgroundColor(),
-            deco->titleBarForegroundColor(),
-            0.8);
+        return deco->paintState().menuForeground;
     } else {
         return Button::foregroundColor();
     }
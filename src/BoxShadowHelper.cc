@@ -17,12 +17,18 @@
 
 // own
 #include "BoxShadowHelper.h"
+#include "ShadowKernels.h"
 
 // Qt
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
 #include <QVector>
+#include <QtMath>
 
 // std
 #include <cmath>
+#include <cstring>
 
 
 namespace Material
@@ -38,17 +44,106 @@ namespace
 // As a workaround, sigma blur scale is lowered. With the lowered sigma
 // blur scale, area under the kernel equals to 0.98, which is pretty enough.
 // Maybe, it should be changed in the future.
-const qreal SIGMA_BLUR_SCALE = 0.4375;
+constexpr qreal SIGMA_BLUR_SCALE = 0.4375;
+
+// Passes over fewer pixels than this are blurred on the calling thread,
+// handing them out costs more than it saves.
+const int PARALLEL_BLUR_THRESHOLD = 256 * 256;
+const int MAX_BLUR_THREADS = 4;
+
+// A private pool, so that blurring never queues behind unrelated work on
+// the global pool. The calling thread blurs a part of every pass itself.
+class BlurThreadPool : public QThreadPool
+{
+public:
+    BlurThreadPool()
+    {
+        setMaxThreadCount(MAX_BLUR_THREADS - 1);
+    }
+};
+
+Q_GLOBAL_STATIC(BlurThreadPool, s_blurThreadPool)
+
+// The box sizes of computeBoxSizes() in integer arithmetic, so that they
+// can be tabulated at compile time. With sigma = 7 * radius / 16 and three
+// passes, 12 * sigma^2 / 3 + 1 = (49 * radius^2 + 64) / 64.
+static_assert(SIGMA_BLUR_SCALE == 7.0 / 16.0, "The box size table assumes sigma = 7 * radius / 16");
+static_assert(NUM_BOX_BLUR_PASSES == 3, "The box size table assumes three passes");
+
+constexpr int integerSqrt(int n)
+{
+    int lower = 0;
+    int upper = n / 2 + 1;
+    while (lower < upper) {
+        const int mid = (lower + upper + 1) / 2;
+        if (mid <= n / mid) {
+            lower = mid;
+        } else {
+            upper = mid - 1;
+        }
+    }
+    return lower;
+}
+
+// Rounds half away from zero, like std::round().
+constexpr int roundedDivision(int numerator, int denominator)
+{
+    return numerator >= 0
+        ? (2 * numerator + denominator) / (2 * denominator)
+        : -((-2 * numerator + denominator) / (2 * denominator));
+}
+
+constexpr BoxSizes kovesiBoxSizes(int radius)
+{
+    int lower = integerSqrt(49 * radius * radius + 64) / 8;
+    if (lower % 2 == 0) {
+        lower--;
+    }
+
+    const int upper = lower + 2;
+    const int threshold = roundedDivision(
+        64 * NUM_BOX_BLUR_PASSES * (lower * lower + 4 * lower + 3) - 147 * radius * radius,
+        256 * (lower + 1));
+
+    BoxSizes result = {};
+    for (int i = 0; i < NUM_BOX_BLUR_PASSES; ++i) {
+        result.sizes[i] = i < threshold ? lower : upper;
+    }
+    return result;
+}
+
+struct BoxSizeTable
+{
+    BoxSizes entries[MAX_BLUR_RADIUS + 1];
+};
+
+constexpr BoxSizeTable makeBoxSizeTable()
+{
+    BoxSizeTable table = {};
+    for (int radius = 0; radius <= MAX_BLUR_RADIUS; ++radius) {
+        table.entries[radius] = kovesiBoxSizes(radius);
+    }
+    return table;
+}
+
+constexpr BoxSizeTable s_boxSizeTable = makeBoxSizeTable();
+
+// Spot checks against computeBoxSizes(), the whole range is compared by
+// the shadow benchmark.
+static_assert(s_boxSizeTable.entries[0].sizes[2] == 1, "Box size table mismatch");
+static_assert(s_boxSizeTable.entries[16].sizes[1] == 13 && s_boxSizeTable.entries[16].sizes[2] == 15, "Box size table mismatch");
+static_assert(s_boxSizeTable.entries[64].sizes[1] == 55 && s_boxSizeTable.entries[64].sizes[2] == 57, "Box size table mismatch");
+static_assert(s_boxSizeTable.entries[256].sizes[1] == 223 && s_boxSizeTable.entries[256].sizes[2] == 225, "Box size table mismatch");
 } // anonymous namespace
 
-inline qreal radiusToSigma(qreal radius)
+const BoxSizes &boxSizes(int radius)
 {
-    return radius * SIGMA_BLUR_SCALE;
+    return s_boxSizeTable.entries[qBound(0, radius, MAX_BLUR_RADIUS)];
 }
 
-inline int boxSizeToRadius(int boxSize)
+inline qreal radiusToSigma(qreal radius)
 {
-    return (boxSize - 1) / 2;
+    return radius * SIGMA_BLUR_SCALE;
 }
 
 QVector<int> computeBoxSizes(int radius, int numIterations)
@@ -77,96 +172,268 @@ QVector<int> computeBoxSizes(int radius, int numIterations)
 
 void boxBlurPass(const QImage &src, QImage &dst, int boxSize)
 {
-    const int alphaStride = src.depth() >> 3;
-    const int alphaOffset = QSysInfo::ByteOrder == QSysInfo::BigEndian ? 0 : 3;
+    const uchar *srcBits = src.constBits();
+    const int srcStride = src.bytesPerLine();
+    uchar *dstBits = dst.bits();
+    const int dstStride = dst.bytesPerLine();
+    const int width = src.width();
+    const int height = src.height();
+
+    // Rows are independent, and so are the columns they are transposed into.
+    auto blurRows = [=](int begin, int end) {
+        ShadowKernels::boxBlurTransposed(
+            srcBits + begin * srcStride, srcStride,
+            dstBits + begin, dstStride,
+            width, end - begin, boxSize);
+    };
+
+    const int blocks = (height + ShadowKernels::BLOCK_ROWS - 1) / ShadowKernels::BLOCK_ROWS;
+    const int tasks = width * height < PARALLEL_BLUR_THRESHOLD
+        ? 1
+        : qMin(blocks, qMin(QThread::idealThreadCount(), MAX_BLUR_THREADS));
+
+    auto taskRows = [=](int task) {
+        return qMin(height, blocks * task / tasks * ShadowKernels::BLOCK_ROWS);
+    };
+
+    QSemaphore done;
+    for (int task = 1; task < tasks; ++task) {
+        const int begin = taskRows(task);
+        const int end = taskRows(task + 1);
+        s_blurThreadPool->start([&done, blurRows, begin, end] {
+            blurRows(begin, end);
+            done.release();
+        });
+    }
 
-    const int radius = boxSizeToRadius(boxSize);
-    const qreal invSize = 1.0 / boxSize;
+    blurRows(0, taskRows(1));
+    done.acquire(tasks - 1);
+}
 
-    const int dstStride = dst.width() * alphaStride;
+// Blurs an alpha mask in QImage::Format_Alpha8.
+void boxBlurAlpha(QImage &image, int radius)
+{
+    // Temporary buffer is transposed so we always read memory
+    // in linear order.
+    QImage tmp(image.height(), image.width(), QImage::Format_Alpha8);
+
+    for (const int &boxSize : boxSizes(radius)) {
+        boxBlurPass(image, tmp, boxSize); // horizontal pass
+        boxBlurPass(tmp, image, boxSize); // vertical pass
+    }
+}
 
-    for (int y = 0; y < src.height(); ++y) {
-        const uchar *srcAlpha = src.scanLine(y);
-        uchar *dstAlpha = dst.scanLine(0);
+// Builds the premultiplied shadow of the given color from the top left
+// quadrant of its alpha mask. The other three quadrants are mirrored, the
+// center row and column belong to the top left quadrant when the size is odd.
+QImage tintMirrored(const QImage &alpha, const QSize &quadrant, const QSize &size, const QColor &color)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+
+    const QRgb premultiplied = qPremultiply(color.rgba());
+    const quint32 a = qAlpha(premultiplied);
+    const quint32 r = qRed(premultiplied);
+    const quint32 g = qGreen(premultiplied);
+    const quint32 b = qBlue(premultiplied);
+
+    const int width = size.width();
+    for (int y = 0; y < quadrant.height(); ++y) {
+        const uchar *in = alpha.constScanLine(y);
+        QRgb *out = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < quadrant.width(); ++x) {
+            const quint32 m = in[x];
+            out[x] = qRgba((r * m + 127) / 255, (g * m + 127) / 255,
+                           (b * m + 127) / 255, (a * m + 127) / 255);
+        }
+        for (int x = quadrant.width(); x < width; ++x) {
+            out[x] = out[width - 1 - x];
+        }
+    }
 
-        srcAlpha += alphaOffset;
-        dstAlpha += alphaOffset + y * alphaStride;
+    const int height = size.height();
+    for (int y = quadrant.height(); y < height; ++y) {
+        std::memcpy(image.scanLine(y), image.constScanLine(height - 1 - y), width * sizeof(QRgb));
+    }
 
-        const uchar *left = srcAlpha;
-        const uchar *right = left + alphaStride * radius;
+    return image;
+}
 
-        int window = 0;
-        for (int x = 0; x < radius; ++x) {
-            window += *srcAlpha;
-            srcAlpha += alphaStride;
-        }
+// Standard deviation of the Gaussian that the box blur passes approximate.
+// Each box of size n adds (n^2 - 1) / 12 to the variance.
+qreal boxSizesToSigma(const BoxSizes &boxSizes)
+{
+    qreal variance = 0;
+    for (const int &boxSize : boxSizes) {
+        variance += (boxSize * boxSize - 1) / 12.0;
+    }
+    return std::sqrt(variance);
+}
 
-        for (int x = 0; x <= radius; ++x) {
-            window += *right;
-            right += alphaStride;
-            *dstAlpha = static_cast<uchar>(window * invSize);
-            dstAlpha += dstStride;
+// Blurred coverage of the span [begin, end) sampled at the center of
+// every pixel, which is the difference of two Gaussian CDFs.
+QVector<qreal> erfProfile(int length, qreal begin, qreal end, qreal sigma)
+{
+    QVector<qreal> profile(length);
+    if (sigma <= 0) {
+        for (int i = 0; i < length; ++i) {
+            profile[i] = qBound(0.0, qMin(end, i + 1.0) - qMax(begin, qreal(i)), 1.0);
         }
+        return profile;
+    }
 
-        for (int x = radius + 1; x < src.width() - radius; ++x) {
-            window += *right - *left;
-            left += alphaStride;
-            right += alphaStride;
-            *dstAlpha = static_cast<uchar>(window * invSize);
-            dstAlpha += dstStride;
-        }
+    const qreal scale = M_SQRT1_2 / sigma;
+    for (int i = 0; i < length; ++i) {
+        const qreal center = i + 0.5;
+        profile[i] = 0.5 * (std::erf((end - center) * scale) - std::erf((begin - center) * scale));
+    }
+    return profile;
+}
 
-        for (int x = src.width() - radius; x < src.width(); ++x) {
-            window -= *left;
-            left += alphaStride;
-            *dstAlpha = static_cast<uchar>(window * invSize);
-            dstAlpha += dstStride;
+void analyticAlpha(QImage &image, const QRectF &box, int radius)
+{
+    // A box is separable, so its blurred alpha is the product of the
+    // blurred horizontal and vertical spans. Matching the variance of the
+    // box blur keeps the result within a few alpha levels of boxBlurAlpha.
+    const qreal sigma = boxSizesToSigma(boxSizes(radius));
+    const QVector<qreal> columns = erfProfile(image.width(), box.left(), box.right(), sigma);
+    const QVector<qreal> rows = erfProfile(image.height(), box.top(), box.bottom(), sigma);
+
+    for (int y = 0; y < image.height(); ++y) {
+        uchar *line = image.scanLine(y);
+        const qreal rowAlpha = 255 * rows[y];
+        for (int x = 0; x < image.width(); ++x) {
+            line[x] = static_cast<uchar>(qRound(rowAlpha * columns[x]));
         }
     }
 }
 
-void boxBlurAlpha(QImage &image, int radius, int numIterations)
+// Blurs enough of the mask around the top left quadrant for the quadrant
+// itself to be exact. Every pass only spreads the missing right and bottom
+// parts of the box by its radius, so the support is the sum of the radii.
+QImage blurredQuadrant(const QSize &size, const QRect &box, const QSize &quadrant, int radius)
 {
-    // Temporary buffer is transposed so we always read memory
-    // in linear order.
-    QImage tmp(image.height(), image.width(), image.format());
+    int support = 0;
+    for (const int &boxSize : boxSizes(radius)) {
+        support += (boxSize - 1) / 2;
+    }
 
-    const QVector<int> boxSizes = computeBoxSizes(radius, numIterations);
-    for (const int &boxSize : boxSizes) {
-        boxBlurPass(image, tmp, boxSize); // horizontal pass
-        boxBlurPass(tmp, image, boxSize); // vertical pass
+    const QSize extent(support, support);
+    QImage alpha(quadrant.boundedTo(size - extent) + extent, QImage::Format_Alpha8);
+    alpha.fill(0);
+
+    const QRect filled = box & alpha.rect();
+    for (int y = filled.top(); y <= filled.bottom(); ++y) {
+        std::memset(alpha.scanLine(y) + filled.left(), 0xff, filled.width());
+    }
+
+    boxBlurAlpha(alpha, radius);
+    return alpha;
+}
+
+// The top left quadrant of the alpha mask of a shadow in device pixels.
+// The whole shadow is `size` large.
+QImage shadowQuadrant(qreal dpr, const QRect &box, int radius, Method method, QSize &size, QSize &quadrant)
+{
+    // The box is centered in the shadow, so the shadow is symmetric in both
+    // directions. Only the top left quadrant is computed and then mirrored.
+    // The blur is done in device pixels, so its radius scales with the image.
+    const int margin = qMin(qRound(radius * dpr), MAX_BLUR_RADIUS);
+    const QRect deviceBox(QPoint(margin, margin), box.size() * dpr);
+    size = deviceBox.size() + 2 * QSize(margin, margin);
+    quadrant = QSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+
+    // There is no need to blur RGB channels. Blur a single channel
+    // alpha mask and then give the shadow a tint of the desired color.
+    if (method == Method::Analytic) {
+        QImage alpha(quadrant, QImage::Format_Alpha8);
+        analyticAlpha(alpha, deviceBox, margin);
+        return alpha;
     }
+    return blurredQuadrant(size, deviceBox, quadrant, margin);
 }
 
-void boxShadow(QPainter *p, const QRect &box, const QPoint &offset, int radius, const QColor &color)
+// Where a shadow of the given device size is drawn, in logical pixels.
+QRect shadowRect(const QSize &size, qreal dpr, const QRect &box, const QPoint &offset)
+{
+    QRect rect(QPoint(0, 0), size / dpr);
+    rect.moveCenter(box.center() + offset);
+    return rect;
+}
+
+void boxShadow(QPainter *p, const QRect &box, const QPoint &offset, int radius, const QColor &color, Method method)
 {
-    const QSize size = box.size() + 2 * QSize(radius, radius);
     const qreal dpr = p->device()->devicePixelRatioF();
 
-    QPainter painter;
+    QSize size;
+    QSize quadrant;
+    const QImage alpha = shadowQuadrant(dpr, box, radius, method, size, quadrant);
 
-    QImage shadow(size * dpr, QImage::Format_ARGB32_Premultiplied);
+    QImage shadow = tintMirrored(alpha, quadrant, size, color);
     shadow.setDevicePixelRatio(dpr);
-    shadow.fill(Qt::transparent);
-
-    painter.begin(&shadow);
-    painter.fillRect(QRect(QPoint(radius, radius), box.size()), Qt::black);
-    painter.end();
-
-    // There is no need to blur RGB channels. Blur the alpha
-    // channel and then give the shadow a tint of the desired color.
-    const int numIterations = 3;
-    boxBlurAlpha(shadow, radius, numIterations);
-
-    painter.begin(&shadow);
-    painter.setCompositionMode(QPainter::CompositionMode_SourceIn);
-    painter.fillRect(shadow.rect(), color);
-    painter.end();
-
-    QRect shadowRect = shadow.rect();
-    shadowRect.setSize(shadowRect.size() / dpr);
-    shadowRect.moveCenter(box.center() + offset);
-    p->drawImage(shadowRect, shadow);
+
+    p->drawImage(shadowRect(size, dpr, box, offset), shadow);
+}
+
+void boxShadowMask(QImage &mask, qreal dpr, const QRect &box, const QPoint &offset, int radius, Method method)
+{
+    QSize size;
+    QSize quadrant;
+    const QImage alpha = shadowQuadrant(dpr, box, radius, method, size, quadrant);
+
+    // Mirror the quadrant straight into the mask, clipped to it.
+    const QPoint origin = shadowRect(size, dpr, box, offset).topLeft() * dpr;
+    const QRect target = QRect(origin, size) & mask.rect();
+    for (int y = target.top(); y <= target.bottom(); ++y) {
+        const int sy = y - origin.y();
+        const uchar *in = alpha.constScanLine(sy < quadrant.height() ? sy : size.height() - 1 - sy);
+        uchar *out = mask.scanLine(y);
+        for (int x = target.left(); x <= target.right(); ++x) {
+            const int sx = x - origin.x();
+            out[x] = in[sx < quadrant.width() ? sx : size.width() - 1 - sx];
+        }
+    }
+}
+
+QImage upscaleMask(const QImage &mask, const QSize &size)
+{
+    // Source coordinates are in 16.16 fixed point and clamped to the
+    // centers of the edge pixels.
+    auto sourceCoordinate = [] (int i, int sourceLength, int length) -> qint64 {
+        const qint64 coordinate = (2 * qint64(i) + 1) * sourceLength * 65536 / (2 * qint64(length)) - 32768;
+        return qBound(qint64(0), coordinate, qint64(sourceLength - 1) * 65536);
+    };
+
+    const int sourceWidth = mask.width();
+    const int sourceHeight = mask.height();
+
+    QVector<int> columns(size.width());
+    QVector<int> columnWeights(size.width());
+    for (int x = 0; x < size.width(); ++x) {
+        const qint64 coordinate = sourceCoordinate(x, sourceWidth, size.width());
+        columns[x] = coordinate >> 16;
+        columnWeights[x] = (coordinate >> 8) & 0xff;
+    }
+
+    QImage result(size, QImage::Format_Alpha8);
+    for (int y = 0; y < size.height(); ++y) {
+        const qint64 coordinate = sourceCoordinate(y, sourceHeight, size.height());
+        const int row = coordinate >> 16;
+        const int rowWeight = (coordinate >> 8) & 0xff;
+        const uchar *top = mask.constScanLine(row);
+        const uchar *bottom = mask.constScanLine(qMin(row + 1, sourceHeight - 1));
+        uchar *out = result.scanLine(y);
+
+        for (int x = 0; x < size.width(); ++x) {
+            const int left = columns[x];
+            const int right = qMin(left + 1, sourceWidth - 1);
+            const int weight = columnWeights[x];
+            const int upper = top[left] * (256 - weight) + top[right] * weight;
+            const int lower = bottom[left] * (256 - weight) + bottom[right] * weight;
+            out[x] = static_cast<uchar>((upper * (256 - rowWeight) + lower * rowWeight + 32768) >> 16);
+        }
+    }
+
+    return result;
 }
 
 } // namespace BoxShadowHelper
@@ -19,17 +19,66 @@
 
 // Qt
 #include <QColor>
+#include <QImage>
 #include <QPainter>
 #include <QPoint>
 #include <QRect>
+#include <QVector>
 
 namespace Material
 {
 namespace BoxShadowHelper
 {
 
+// Shadows are blurred with this many box blur passes, which approximate a
+// Gaussian blur.
+const int NUM_BOX_BLUR_PASSES = 3;
+
+// Blur radii are in device pixels and larger ones are clamped to this.
+const int MAX_BLUR_RADIUS = 384;
+
+struct BoxSizes
+{
+    int sizes[NUM_BOX_BLUR_PASSES];
+
+    constexpr const int *begin() const { return sizes; }
+    constexpr const int *end() const { return sizes + NUM_BOX_BLUR_PASSES; }
+};
+
+// The box sizes of the passes for a blur radius. They are looked up in a
+// table that is computed at compile time.
+const BoxSizes &boxSizes(int radius);
+
+// Computes the same box sizes at run time, the table is checked against it.
+QVector<int> computeBoxSizes(int radius, int numIterations);
+
+// One horizontal box blur pass over a Format_Alpha8 image. The result is
+// written transposed into dst, which has to be of the transposed size.
+void boxBlurPass(const QImage &src, QImage &dst, int boxSize);
+
+// All passes of the blur for a radius, in place.
+void boxBlurAlpha(QImage &image, int radius);
+
+enum class Method {
+    // Three box blur passes over a rasterized box.
+    BoxBlur,
+    // Product of horizontal and vertical erf profiles, no blurring at all.
+    Analytic,
+};
+
 void boxShadow(QPainter *p, const QRect &box, const QPoint &offset,
-               int radius, const QColor &color);
+               int radius, const QColor &color, Method method = Method::BoxBlur);
+
+// Renders only the alpha of a box shadow into mask, a Format_Alpha8 image
+// with the given device pixel ratio. The box and the offset are in logical
+// pixels, like with boxShadow(). The shadow replaces what is in the mask.
+void boxShadowMask(QImage &mask, qreal dpr, const QRect &box, const QPoint &offset,
+                   int radius, Method method = Method::BoxBlur);
+
+// Bilinearly scales a Format_Alpha8 mask up to size, with the centers of
+// the pixels aligned. Shadows are smooth enough to be blurred at a lower
+// resolution and scaled up afterwards.
+QImage upscaleMask(const QImage &mask, const QSize &size);
 
 } // namespace BoxShadowHelper
 } // namespace Material
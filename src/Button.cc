@@ -19,6 +19,7 @@
 // own
 #include "Button.h"
 #include "Material.h"
+#include "ButtonGlyphCache.h"
 #include "Decoration.h"
 
 #include "AppIconButton.h"
@@ -37,9 +38,6 @@
 #include <KDecoration2/Decoration>
 #include <KDecoration2/DecorationButton>
 
-// KF
-#include <KColorUtils>
-
 // Qt
 #include <QDebug>
 #include <QMargins>
@@ -62,7 +60,7 @@ Button::Button(KDecoration2::DecorationButtonType type, Decoration *decoration,
     connect(this, &Button::hoveredChanged, this,
         [this](bool hovered) {
             updateAnimationState(hovered);
-            update();
+            scheduleRepaint();
         });
 
     if (QCoreApplication::applicationName() == QStringLiteral("kded5")) {
@@ -84,11 +82,11 @@ Button::Button(KDecoration2::DecorationButtonType type, Decoration *decoration,
         setTransitionValue(value.toReal());
     });
     connect(this, &Button::transitionValueChanged, this, [this]() {
-        update();
+        scheduleRepaint();
     });
 
     connect(this, &Button::opacityChanged, this, [this]() {
-        update();
+        scheduleRepaint();
     });
 
     setHeight(decoration->titleBarHeight());
@@ -176,10 +174,11 @@ Button::Button(QObject *parent, const QVariantList &args)
 
 void Button::paint(QPainter *painter, const QRect &repaintRegion)
 {
-    Q_UNUSED(repaintRegion)
-
     // Buttons are coded assuming 24 units in size.
     const QRectF buttonRect = geometry();
+    if (!repaintRegion.intersects(buttonRect.toAlignedRect())) {
+        return;
+    }
     const QRectF contentRect = contentArea();
 
     const qreal iconScale = contentRect.height()/24;
@@ -213,13 +212,47 @@ void Button::paint(QPainter *painter, const QRect &repaintRegion)
 
     const qreal gridUnit = iconRect.height()/10;
 
-    painter->save();
+    // Drawn from the shared glyphs, except for the buttons whose content
+    // is not a plain icon. The GTK bridge renders each button only once.
+    const bool cacheable = !m_isGtkButton
+        && iconSize > 0
+        && type() != KDecoration2::DecorationButtonType::Menu
+        && type() != KDecoration2::DecorationButtonType::Custom;
 
-    painter->setRenderHints(QPainter::Antialiasing);
+    painter->save();
 
     // Opacity
     painter->setOpacity(m_opacity);
 
+    if (cacheable) {
+        ButtonGlyphKey key;
+        key.type = static_cast<int>(type());
+        key.checked = isChecked();
+        key.iconSize = iconSize;
+        key.devicePixelRatio = painter->device()->devicePixelRatioF();
+        key.background = backgroundColor().rgba();
+        key.foreground = foregroundColor().rgba();
+
+        // The background is centered on an integer point, so the glyph
+        // looks the same wherever the button is.
+        const QPointF origin = backgroundRect.topLeft();
+        const QImage glyph = ButtonGlyphCache::instance()->glyph(key, [&](QPainter *glyphPainter) {
+            paintGlyph(glyphPainter, buttonRect.translated(-origin),
+                backgroundRect.translated(-origin), iconRect.translated(-origin), gridUnit);
+        });
+        painter->drawImage(origin, glyph);
+    } else {
+        paintGlyph(painter, buttonRect, backgroundRect, iconRect, gridUnit);
+    }
+
+    painter->restore();
+}
+
+void Button::paintGlyph(QPainter *painter, const QRectF &buttonRect, const QRectF &backgroundRect,
+                        const QRectF &iconRect, const qreal gridUnit)
+{
+    painter->setRenderHints(QPainter::Antialiasing);
+
     // Background.
     painter->setPen(Qt::NoPen);
     painter->setBrush(backgroundColor());
@@ -280,8 +313,15 @@ void Button::paint(QPainter *painter, const QRect &repaintRegion)
         paintIcon(painter, iconRect, gridUnit);
         break;
     }
+}
 
-    painter->restore();
+void Button::scheduleRepaint()
+{
+    if (auto *deco = qobject_cast<Decoration *>(decoration())) {
+        deco->scheduleRepaint(geometry().toAlignedRect());
+    } else {
+        update();
+    }
 }
 
 void Button::paintIcon(QPainter *painter, const QRectF &iconRect, const qreal gridUnit)
@@ -334,29 +374,26 @@ void Button::setPenWidth(QPainter *painter, const qreal gridUnit, const qreal sc
         
         QColor returnVal;
         QColor normalColor = QColor(0,0,0,0);
-        auto c = d->client().toStrongRef().data();
-        bool circleClose = d->isCloseButtonCircled();
-
-        QColor redColor( c->color( KDecoration2::ColorGroup::Warning, KDecoration2::ColorRole::Foreground ) );
+        const Decoration::PaintState &state = d->paintState();
 
         if (type() == KDecoration2::DecorationButtonType::Menu) {
             returnVal= normalColor;
         } else if( isPressed() ) {
 
-            if( type() == KDecoration2::DecorationButtonType::Close) returnVal = redColor.darker();
-            else returnVal = KColorUtils::mix( normalColor, d->titleBarForegroundColor(), 0.5 );
+            if( type() == KDecoration2::DecorationButtonType::Close) returnVal = state.warning.darker();
+            else returnVal = state.buttonPressed;
 
         } else if( isChecked() && type() != KDecoration2::DecorationButtonType::Maximize ) {
 
-            returnVal = d->titleBarForegroundColor();
+            returnVal = state.titleBarForeground;
 
         } else if( isHovered() ) {
 
-            if( type() == KDecoration2::DecorationButtonType::Close ) {return c->isActive() ? redColor.lighter() : redColor;}
-            else {returnVal = d->titleBarForegroundColor();}
+            if( type() == KDecoration2::DecorationButtonType::Close ) {return state.active ? state.warning.lighter() : state.warning;}
+            else {returnVal = state.titleBarForeground;}
         } else {
-            if (type() == KDecoration2::DecorationButtonType::Close && circleClose) {
-                returnVal = c->isActive() ? redColor : d->titleBarForegroundColor();
+            if (type() == KDecoration2::DecorationButtonType::Close && state.closeButtonCircled) {
+                returnVal = state.active ? state.warning : state.titleBarForeground;
             } else {
                 returnVal = normalColor;
             }
@@ -369,31 +406,32 @@ void Button::setPenWidth(QPainter *painter, const qreal gridUnit, const qreal sc
     QColor Button::foregroundColor() const
     {
         auto d = qobject_cast<Decoration*>( decoration() );
-        bool circleClose = d->isCloseButtonCircled();
         if( !d ) {
 
             return QColor();
 
-        } else if( isPressed() ) {
+        }
+
+        const Decoration::PaintState &state = d->paintState();
+        if( isPressed() ) {
 
-            return d->titleBarBackgroundColor();
+            return state.titleBarBackground;
 
         } else if( isChecked() && type() != KDecoration2::DecorationButtonType::Maximize) {
 
-            return d->titleBarBackgroundColor();
+            return state.titleBarBackground;
 
         } else if( isHovered() ) {
 
-            return d->titleBarBackgroundColor();
+            return state.titleBarBackground;
 
-        } else if (type() == KDecoration2::DecorationButtonType::Close && circleClose) {
-            return d->titleBarBackgroundColor();
+        } else if (type() == KDecoration2::DecorationButtonType::Close && state.closeButtonCircled) {
+            return state.titleBarBackground;
         } else {
 
-            return d->titleBarForegroundColor();
+            return state.titleBarForeground;
 
         }
-        return d->titleBarForegroundColor();
     }
 
 
@@ -58,6 +58,9 @@ public:
     void paint(QPainter *painter, const QRect &repaintRegion) override;
     virtual void paintIcon(QPainter *painter, const QRectF &iconRect, const qreal gridUnit);
 
+    // Like update(), but merged with the decoration's other repaints.
+    void scheduleRepaint();
+
     virtual void updateSize(int contentWidth, int contentHeight);
     virtual void setHeight(int buttonHeight);
 
@@ -97,6 +100,9 @@ signals:
     void paddingChanged();
 
 private:
+    void paintGlyph(QPainter *painter, const QRectF &buttonRect, const QRectF &backgroundRect,
+                    const QRectF &iconRect, const qreal gridUnit);
+
     bool m_animationEnabled;
     QVariantAnimation *m_animation;
     qreal m_opacity;
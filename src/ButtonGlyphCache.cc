@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// own
+#include "ButtonGlyphCache.h"
+
+// Qt
+#include <QPainter>
+
+namespace Material
+{
+
+Q_GLOBAL_STATIC(ButtonGlyphCache, s_buttonGlyphCache)
+
+bool ButtonGlyphKey::operator==(const ButtonGlyphKey &other) const
+{
+    return type == other.type
+        && checked == other.checked
+        && iconSize == other.iconSize
+        && devicePixelRatio == other.devicePixelRatio
+        && background == other.background
+        && foreground == other.foreground;
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+size_t qHash(const ButtonGlyphKey &key, size_t seed)
+#else
+uint qHash(const ButtonGlyphKey &key, uint seed)
+#endif
+{
+    seed ^= ::qHash(key.type) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.checked) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.iconSize) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.devicePixelRatio) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.background) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.foreground) + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+ButtonGlyphCache *ButtonGlyphCache::instance()
+{
+    return s_buttonGlyphCache();
+}
+
+QImage ButtonGlyphCache::glyph(const ButtonGlyphKey &key, const std::function<void(QPainter *)> &paint)
+{
+    if (const QImage *cached = m_glyphs.object(key)) {
+        return *cached;
+    }
+
+    const QSize size = QSize(2 * key.iconSize, 2 * key.iconSize) * key.devicePixelRatio;
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(key.devicePixelRatio);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    paint(&painter);
+    painter.end();
+
+    const int cost = qMax(1, static_cast<int>(image.sizeInBytes() / 1024));
+    m_glyphs.insert(key, new QImage(image), cost);
+    return image;
+}
+
+void ButtonGlyphCache::clear()
+{
+    m_glyphs.clear();
+}
+
+} // namespace Material
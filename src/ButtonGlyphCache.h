@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Qt
+#include <QCache>
+#include <QColor>
+#include <QHash>
+#include <QImage>
+
+// std
+#include <functional>
+
+class QPainter;
+
+namespace Material
+{
+
+// Everything a button's background and icon are painted from. The
+// hovered, pressed and checked states and the window's focus only show
+// through the colors, except for the checked icons of Maximize and Shade.
+struct ButtonGlyphKey
+{
+    int type = 0;
+    bool checked = false;
+    int iconSize = 0;
+    qreal devicePixelRatio = 1;
+    QRgb background = 0;
+    QRgb foreground = 0;
+
+    bool operator==(const ButtonGlyphKey &other) const;
+};
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+size_t qHash(const ButtonGlyphKey &key, size_t seed = 0);
+#else
+uint qHash(const ButtonGlyphKey &key, uint seed = 0);
+#endif
+
+// Button backgrounds and icons rasterized once and shared by the buttons
+// of all decorations, so that painting a button only draws an image. The
+// least recently used glyphs are dropped once they exceed MAX_COST.
+class ButtonGlyphCache
+{
+public:
+    static ButtonGlyphCache *instance();
+
+    // The glyph is a square of 2 * iconSize logical pixels. On a miss it
+    // is rendered by calling paint with a painter on a transparent image.
+    QImage glyph(const ButtonGlyphKey &key, const std::function<void(QPainter *)> &paint);
+    void clear();
+
+private:
+    // The cost of an entry is the size of its image in KiB.
+    static const int MAX_COST = 2 * 1024;
+
+    QCache<ButtonGlyphKey, QImage> m_glyphs{MAX_COST};
+};
+
+} // namespace Material
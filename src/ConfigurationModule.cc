@@ -56,7 +56,13 @@ ConfigurationModule::ConfigurationModule(QWidget *parent, const QVariantList &ar
     : KCModule(parent, args)
     , m_titleAlignment(InternalSettings::AlignCenterFullWidth)
     , m_buttonSize(InternalSettings::ButtonDefault)
+    , m_renderTitleBarInBackground(false)
     , m_shadowSize(InternalSettings::ShadowVeryLarge)
+    , m_shadowRadius(64)
+    , m_inactiveShadowSameAsActive(true)
+    , m_inactiveShadowSize(InternalSettings::InactiveShadowVeryLarge)
+    , m_shadowMethod(InternalSettings::ShadowBoxBlur)
+    , m_shadowResolution(InternalSettings::ShadowFullResolution)
     , m_circleClose(false)
 {
     init();
@@ -120,6 +126,12 @@ void ConfigurationModule::init()
     inactiveOpacity->setObjectName(QStringLiteral("kcfg_InactiveOpacity"));
     generalForm->addRow(i18n("Inactive Opacity:"), inactiveOpacity);
 
+    QCheckBox *renderTitleBarInBackground = new QCheckBox(generalTab);
+    renderTitleBarInBackground->setText(i18n("Render title bar in the background"));
+    renderTitleBarInBackground->setToolTip(i18n("Spreads rendering over all cores when many windows change at once. The title may keep its previous color for a frame after focus or color scheme changes."));
+    renderTitleBarInBackground->setObjectName(QStringLiteral("kcfg_RenderTitleBarInBackground"));
+    generalForm->addRow(QStringLiteral(""), renderTitleBarInBackground);
+
 
     //--- Menu
     QWidget *menuTab = new QWidget(tabWidget);
@@ -188,9 +200,44 @@ void ConfigurationModule::init()
     shadowSizes->addItem(i18ndc("breeze_kwin_deco", "@item:inlistbox Button size:", "Medium"));
     shadowSizes->addItem(i18ndc("breeze_kwin_deco", "@item:inlistbox Button size:", "Large"));
     shadowSizes->addItem(i18ndc("breeze_kwin_deco", "@item:inlistbox Button size:", "Very Large"));
+    shadowSizes->addItem(i18n("Custom"));
     shadowSizes->setObjectName(QStringLiteral("kcfg_ShadowSize"));
     shadowForm->addRow(i18nd("breeze_kwin_deco", "Si&ze:"), shadowSizes);
 
+    QSpinBox *shadowRadius = new QSpinBox(shadowTab);
+    shadowRadius->setMinimum(4);
+    shadowRadius->setMaximum(128);
+    shadowRadius->setSuffix(i18nd("breeze_kwin_deco", " px"));
+    shadowRadius->setObjectName(QStringLiteral("kcfg_ShadowRadius"));
+    shadowForm->addRow(i18n("Radius:"), shadowRadius);
+
+    QCheckBox *inactiveShadowSameAsActive = new QCheckBox(shadowTab);
+    inactiveShadowSameAsActive->setText(i18n("Same shadow for inactive windows"));
+    inactiveShadowSameAsActive->setObjectName(QStringLiteral("kcfg_InactiveShadowSameAsActive"));
+    shadowForm->addRow(QStringLiteral(""), inactiveShadowSameAsActive);
+
+    QComboBox *inactiveShadowSizes = new QComboBox(shadowTab);
+    for (int i = 0; i < shadowSizes->count(); ++i) {
+        inactiveShadowSizes->addItem(shadowSizes->itemText(i));
+    }
+    inactiveShadowSizes->setObjectName(QStringLiteral("kcfg_InactiveShadowSize"));
+    shadowForm->addRow(i18n("Inactive Size:"), inactiveShadowSizes);
+
+    // Both window states share the custom radius.
+    auto updateShadowRadiusEnabled = [shadowSizes, inactiveShadowSameAsActive, inactiveShadowSizes, shadowRadius] {
+        const bool inactiveCustom = !inactiveShadowSameAsActive->isChecked()
+            && inactiveShadowSizes->currentIndex() == InternalSettings::InactiveShadowCustom;
+        shadowRadius->setEnabled(shadowSizes->currentIndex() == InternalSettings::ShadowCustom
+            || inactiveCustom);
+    };
+    connect(shadowSizes, QOverload<int>::of(&QComboBox::currentIndexChanged),
+        this, updateShadowRadiusEnabled);
+    connect(inactiveShadowSizes, QOverload<int>::of(&QComboBox::currentIndexChanged),
+        this, updateShadowRadiusEnabled);
+    connect(inactiveShadowSameAsActive, &QCheckBox::toggled,
+        this, updateShadowRadiusEnabled);
+    updateShadowRadiusEnabled();
+
     QSpinBox *shadowStrength = new QSpinBox(shadowTab);
     shadowStrength->setMinimum(25);
     shadowStrength->setMaximum(255);
@@ -198,10 +245,37 @@ void ConfigurationModule::init()
     shadowStrength->setObjectName(QStringLiteral("kcfg_ShadowStrength"));
     shadowForm->addRow(i18ndc("breeze_kwin_deco", "strength of the shadow (from transparent to opaque)", "S&trength:"), shadowStrength);
 
+    QSpinBox *inactiveShadowStrength = new QSpinBox(shadowTab);
+    inactiveShadowStrength->setMinimum(25);
+    inactiveShadowStrength->setMaximum(255);
+    inactiveShadowStrength->setObjectName(QStringLiteral("kcfg_InactiveShadowStrength"));
+    shadowForm->addRow(i18n("Inactive Strength:"), inactiveShadowStrength);
+
+    auto updateInactiveShadowEnabled = [inactiveShadowSameAsActive, inactiveShadowSizes, inactiveShadowStrength] {
+        inactiveShadowSizes->setEnabled(!inactiveShadowSameAsActive->isChecked());
+        inactiveShadowStrength->setEnabled(!inactiveShadowSameAsActive->isChecked());
+    };
+    connect(inactiveShadowSameAsActive, &QCheckBox::toggled,
+        this, updateInactiveShadowEnabled);
+    updateInactiveShadowEnabled();
+
     KColorButton *shadowColor = new KColorButton(shadowTab);
     shadowColor->setObjectName(QStringLiteral("kcfg_ShadowColor"));
     shadowForm->addRow(i18nd("breeze_kwin_deco", "Color:"), shadowColor);
 
+    QComboBox *shadowMethod = new QComboBox(shadowTab);
+    shadowMethod->addItem(i18n("Box Blur"));
+    shadowMethod->addItem(i18n("Analytic"));
+    shadowMethod->setObjectName(QStringLiteral("kcfg_ShadowMethod"));
+    shadowForm->addRow(i18n("Rendering:"), shadowMethod);
+
+    QComboBox *shadowResolution = new QComboBox(shadowTab);
+    shadowResolution->addItem(i18n("Full"));
+    shadowResolution->addItem(i18n("Half"));
+    shadowResolution->addItem(i18n("Quarter"));
+    shadowResolution->setObjectName(QStringLiteral("kcfg_ShadowResolution"));
+    shadowForm->addRow(i18n("Resolution:"), shadowResolution);
+
     //--- Config Bindings
     skel->addItemInt(
         QStringLiteral("TitleAlignment"),
@@ -235,6 +309,12 @@ void ConfigurationModule::init()
         0.85,
         QStringLiteral("InactiveOpacity")
     );
+    skel->addItemBool(
+        QStringLiteral("RenderTitleBarInBackground"),
+        m_renderTitleBarInBackground,
+        false,
+        QStringLiteral("RenderTitleBarInBackground")
+    );
     skel->addItemBool(
         QStringLiteral("MenuAlwaysShow"),
         m_menuAlwaysShow,
@@ -265,12 +345,48 @@ void ConfigurationModule::init()
         InternalSettings::ShadowVeryLarge,
         QStringLiteral("ShadowSize")
     );
+    skel->addItemInt(
+        QStringLiteral("ShadowRadius"),
+        m_shadowRadius,
+        64,
+        QStringLiteral("ShadowRadius")
+    );
     skel->addItemInt(
         QStringLiteral("ShadowStrength"),
         m_shadowStrength,
         255,
         QStringLiteral("ShadowStrength")
     );
+    skel->addItemBool(
+        QStringLiteral("InactiveShadowSameAsActive"),
+        m_inactiveShadowSameAsActive,
+        true,
+        QStringLiteral("InactiveShadowSameAsActive")
+    );
+    skel->addItemInt(
+        QStringLiteral("InactiveShadowSize"),
+        m_inactiveShadowSize,
+        InternalSettings::InactiveShadowVeryLarge,
+        QStringLiteral("InactiveShadowSize")
+    );
+    skel->addItemInt(
+        QStringLiteral("InactiveShadowStrength"),
+        m_inactiveShadowStrength,
+        255,
+        QStringLiteral("InactiveShadowStrength")
+    );
+    skel->addItemInt(
+        QStringLiteral("ShadowMethod"),
+        m_shadowMethod,
+        InternalSettings::ShadowBoxBlur,
+        QStringLiteral("ShadowMethod")
+    );
+    skel->addItemInt(
+        QStringLiteral("ShadowResolution"),
+        m_shadowResolution,
+        InternalSettings::ShadowFullResolution,
+        QStringLiteral("ShadowResolution")
+    );
     skel->addItem(new KConfigSkeleton::ItemColor(
         skel->currentGroup(),
         QStringLiteral("ShadowColor"),
@@ -39,12 +39,19 @@ private:
     int m_buttonSize;
     double m_activeOpacity;
     double m_inactiveOpacity;
+    bool m_renderTitleBarInBackground;
     bool m_menuAlwaysShow;
     int m_menuButtonHorzPadding;
     bool m_animationsEnabled;
     int m_animationsDuration;
     int m_shadowSize;
+    int m_shadowRadius;
     int m_shadowStrength;
+    bool m_inactiveShadowSameAsActive;
+    int m_inactiveShadowSize;
+    int m_inactiveShadowStrength;
+    int m_shadowMethod;
+    int m_shadowResolution;
     QColor m_shadowColor;
     bool m_circleClose;
 };
@@ -23,9 +23,10 @@
 #include "Material.h"
 #include "BuildConfig.h"
 #include "AppMenuButtonGroup.h"
-#include "BoxShadowHelper.h"
 #include "Button.h"
+#include "ButtonGlyphCache.h"
 #include "InternalSettings.h"
+#include "ShadowCache.h"
 
 // KDecoration
 #include <KDecoration2/DecoratedClient>
@@ -35,18 +36,26 @@
 #include <KDecoration2/DecorationShadow>
 
 // KF
+#include <KColorUtils>
 #include <KWindowSystem>
 
 // Qt
 #include <QApplication>
 #include <QDebug>
+#include <QFontDatabase>
+#include <QFontMetrics>
 #include <QHoverEvent>
+#include <QLinearGradient>
 #include <QMouseEvent>
 #include <QPainter>
 #include <QRegion>
 #include <QSharedPointer>
+#include <QThreadPool>
 #include <QWheelEvent>
 
+// std
+#include <atomic>
+
 // X11
 #if HAVE_X11
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
@@ -60,99 +69,19 @@
 namespace Material
 {
 
-namespace
-{
-
-struct ShadowParams
-{
-    ShadowParams() = default;
-
-    ShadowParams(const QPoint &offset, int radius, qreal opacity)
-        : offset(offset)
-        , radius(radius)
-        , opacity(opacity) {}
+static int s_decoCount = 0;
 
-    QPoint offset;
-    int radius = 0;
-    qreal opacity = 0;
-};
+// The captions of all decorations are rendered on this pool when
+// RenderTitleBarInBackground is set, so that many of them changing at
+// once are spread over the cores.
+Q_GLOBAL_STATIC(QThreadPool, s_titleBarThreadPool)
 
-struct CompositeShadowParams
+struct Decoration::TitleBarJob
 {
-    CompositeShadowParams() = default;
-
-    CompositeShadowParams(
-            const QPoint &offset,
-            const ShadowParams &shadow1,
-            const ShadowParams &shadow2)
-        : offset(offset)
-        , shadow1(shadow1)
-        , shadow2(shadow2) {}
-
-    bool isNone() const {
-        return qMax(shadow1.radius, shadow2.radius) == 0;
-    }
-
-    QPoint offset;
-    ShadowParams shadow1;
-    ShadowParams shadow2;
+    TitleBarLayerKey key;
+    std::atomic<bool> cancelled{false};
 };
 
-// const CompositeShadowParams s_shadowParams = CompositeShadowParams(
-//     QPoint(0, 18),
-//     ShadowParams(QPoint(0, 0), 64, 0.8),
-//     ShadowParams(QPoint(0, -10), 24, 0.1)
-// );
-const CompositeShadowParams s_shadowParams[] = {
-    // None
-    CompositeShadowParams(),
-    // Small
-    CompositeShadowParams(
-        QPoint(0, 4),
-        ShadowParams(QPoint(0, 0), 16, 1),
-        ShadowParams(QPoint(0, -2), 8, 0.4)),
-    // Medium
-    CompositeShadowParams(
-        QPoint(0, 8),
-        ShadowParams(QPoint(0, 0), 32, 0.9),
-        ShadowParams(QPoint(0, -4), 16, 0.3)),
-    // Large
-    CompositeShadowParams(
-        QPoint(0, 12),
-        ShadowParams(QPoint(0, 0), 48, 0.8),
-        ShadowParams(QPoint(0, -6), 24, 0.2)),
-    // Very large
-    CompositeShadowParams(
-        QPoint(0, 16),
-        ShadowParams(QPoint(0, 0), 64, 0.7),
-        ShadowParams(QPoint(0, -8), 32, 0.1)),
-};
-
-inline CompositeShadowParams lookupShadowParams(int size)
-{
-    switch (size) {
-    case InternalSettings::ShadowNone:
-        return s_shadowParams[0];
-    case InternalSettings::ShadowSmall:
-        return s_shadowParams[1];
-    case InternalSettings::ShadowMedium:
-        return s_shadowParams[2];
-    default:
-    case InternalSettings::ShadowLarge:
-        return s_shadowParams[3];
-    case InternalSettings::ShadowVeryLarge:
-        return s_shadowParams[4];
-    }
-}
-
-} // anonymous namespace
-
-static int s_decoCount = 0;
-static int s_shadowSizePreset = InternalSettings::ShadowVeryLarge;
-static int s_shadowStrength = 255;
-static QColor s_shadowColor = QColor(33, 33, 33);
-static QSharedPointer<KDecoration2::DecorationShadow> s_cachedShadow;
-
 Decoration::Decoration(QObject *parent, const QVariantList &args)
     : KDecoration2::Decoration(parent, args)
     , m_internalSettings(nullptr)
@@ -162,8 +91,11 @@ Decoration::Decoration(QObject *parent, const QVariantList &args)
 
 Decoration::~Decoration()
 {
+    cancelTitleBarJob();
+
     if (--s_decoCount == 0) {
-        s_cachedShadow.clear();
+        ShadowCache::instance()->clear();
+        ButtonGlyphCache::instance()->clear();
     }
 }
 
@@ -192,21 +124,70 @@ QRect Decoration::centerRect() const
 
 void Decoration::paint(QPainter *painter, const QRect &repaintRegion)
 {
-    auto *decoratedClient = client().toStrongRef().data();
+    // The painter targets the output the window is on. Pick the shadow for
+    // its scale once this paint is done.
+    const qreal devicePixelRatio = painter->device()->devicePixelRatioF();
+    if (!qFuzzyCompare(m_devicePixelRatio, devicePixelRatio)) {
+        m_devicePixelRatio = devicePixelRatio;
+        QMetaObject::invokeMethod(this, &Decoration::updateShadow, Qt::QueuedConnection);
+    }
+
+    // Nothing is painted outside of the damage, and the parts that are
+    // entirely outside of it are skipped.
+    painter->save();
+    painter->setClipRect(repaintRegion, Qt::IntersectClip);
 
-    if (!decoratedClient->isShaded()) {
+    if (!m_paintState.shaded) {
         paintFrameBackground(painter, repaintRegion);
     }
 
     paintTitleBarBackground(painter, repaintRegion);
     paintButtons(painter, repaintRegion);
-    paintCaption(painter, repaintRegion);
+    // Over the buttons, like the caption always was. The app menu shares
+    // the space between the button groups with it.
+    paintTitleBarLayer(painter, repaintRegion);
 
     // Don't paint outline for NoBorder, NoSideBorder, or Tiny borders.
     if (settings()->borderSize() >= KDecoration2::BorderSize::Normal) {
         paintOutline(painter, repaintRegion);
     }
-    updateBlur();
+
+    painter->restore();
+}
+
+void Decoration::scheduleRepaint(const QRect &rect)
+{
+    ++m_repaintRequests;
+    m_pendingRepaint += rect;
+    if (m_repaintScheduled) {
+        return;
+    }
+
+    // Flushed once control returns to the event loop, which is before
+    // KWin composites its next frame.
+    m_repaintScheduled = true;
+    QMetaObject::invokeMethod(this, &Decoration::flushRepaints, Qt::QueuedConnection);
+}
+
+void Decoration::scheduleRepaint()
+{
+    scheduleRepaint(rect());
+}
+
+void Decoration::flushRepaints()
+{
+    m_repaintScheduled = false;
+    ++m_repaintFlushes;
+
+    for (const QRect &rect : qAsConst(m_pendingRepaint)) {
+        update(rect);
+    }
+    m_pendingRepaint = QRegion();
+}
+
+int Decoration::coalescedRepaints() const
+{
+    return m_repaintRequests - m_repaintFlushes;
 }
 
 void Decoration::init()
@@ -215,8 +196,25 @@ void Decoration::init()
 
     auto *decoratedClient = client().toStrongRef().data();
 
+    // Connected first, so that everything else already sees the new state.
+    updatePaintState();
+    connect(decoratedClient, &KDecoration2::DecoratedClient::activeChanged,
+            this, &Decoration::updatePaintState);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::shadedChanged,
+            this, &Decoration::updatePaintState);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::captionChanged,
+            this, &Decoration::updatePaintState);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::paletteChanged,
+            this, &Decoration::updatePaintState);
+
     auto repaintTitleBar = [this] {
-        update(titleBar());
+        scheduleRepaint(titleBar());
+    };
+    // The caption and the app menu never leave the space between the
+    // button groups.
+    auto repaintCenter = [this] {
+        invalidateTitleBarLayer();
+        scheduleRepaint(centerRect());
     };
 
     m_leftButtons = new KDecoration2::DecorationButtonGroup(
@@ -233,9 +231,23 @@ void Decoration::init()
     connect(m_menuButtons, &AppMenuButtonGroup::menuUpdated,
             this, &Decoration::updateButtonsGeometry);
     connect(m_menuButtons, &AppMenuButtonGroup::opacityChanged,
-            this, repaintTitleBar);
+            this, repaintCenter);
     connect(m_menuButtons, &AppMenuButtonGroup::alwaysShowChanged,
-            this, repaintTitleBar);
+            this, repaintCenter);
+    connect(m_menuButtons, &AppMenuButtonGroup::overflowingChanged,
+            this, repaintCenter);
+
+    // The caption is laid out between the button groups and after the menu.
+    connect(m_leftButtons, &KDecoration2::DecorationButtonGroup::geometryChanged,
+            this, &Decoration::invalidateTitleBarLayer);
+    connect(m_rightButtons, &KDecoration2::DecorationButtonGroup::geometryChanged,
+            this, &Decoration::invalidateTitleBarLayer);
+    connect(m_menuButtons, &KDecoration2::DecorationButtonGroup::geometryChanged,
+            this, &Decoration::invalidateTitleBarLayer);
+    connect(m_menuButtons, &AppMenuButtonGroup::menuUpdated,
+            this, &Decoration::invalidateTitleBarLayer);
+    connect(this, &KDecoration2::Decoration::bordersChanged,
+            this, &Decoration::invalidateTitleBarLayer);
     m_menuButtons->updateAppMenuModel();
 
 
@@ -256,14 +268,31 @@ void Decoration::init()
             this, &Decoration::updateBorders);
 
     connect(decoratedClient, &KDecoration2::DecoratedClient::captionChanged,
-            this, repaintTitleBar);
+            this, repaintCenter);
     connect(decoratedClient, &KDecoration2::DecoratedClient::activeChanged,
             this, repaintTitleBar);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::activeChanged,
+            this, &Decoration::updateActiveShadow);
+
+    // Everything the translucent region depends on.
+    connect(this, &KDecoration2::Decoration::bordersChanged,
+            this, &Decoration::updateBlur);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::widthChanged,
+            this, &Decoration::updateBlur);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::heightChanged,
+            this, &Decoration::updateBlur);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::shadedChanged,
+            this, &Decoration::updateBlur);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::activeChanged,
+            this, &Decoration::updateBlur);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::paletteChanged,
+            this, &Decoration::updateBlur);
 
     updateBorders();
     updateResizeBorders();
     updateTitleBar();
     updateButtonsGeometry();
+    updateBlur();
 
     connect(this, &KDecoration2::Decoration::sectionUnderMouseChanged,
             this, &Decoration::onSectionUnderMouseChanged);
@@ -271,6 +300,8 @@ void Decoration::init()
 
     // For some reason, the shadow should be installed the last. Otherwise,
     // the Window Decorations KCM crashes.
+    connect(ShadowCache::instance(), &ShadowCache::shadowReady,
+        this, &Decoration::onShadowReady);
     updateShadow();
 
     connect(settings().data(), &KDecoration2::DecorationSettings::reconfigured,
@@ -287,11 +318,16 @@ void Decoration::init()
         this, &Decoration::updateBorders);
     connect(settings().data(), &KDecoration2::DecorationSettings::spacingChanged,
         this, &Decoration::updateBorders);
+    connect(settings().data(), &KDecoration2::DecorationSettings::fontChanged,
+        this, &Decoration::invalidateTitleBarLayer);
+    connect(settings().data(), &KDecoration2::DecorationSettings::spacingChanged,
+        this, &Decoration::invalidateTitleBarLayer);
 }
 
 void Decoration::reconfigure()
 {
     m_internalSettings->load();
+    updatePaintState();
 
     updateBorders();
     updateTitleBar();
@@ -299,7 +335,8 @@ void Decoration::reconfigure()
     updateButtonsGeometry();
     updateButtonAnimation();
     updateShadow();
-    update();
+    updateBlur();
+    scheduleRepaint();
 }
 
 void Decoration::mousePressEvent(QMouseEvent *event)
@@ -326,7 +363,6 @@ void Decoration::hoverEnterEvent(QHoverEvent *event)
 {
     KDecoration2::Decoration::hoverEnterEvent(event);
     qCDebug(category) << "Decoration::hoverEnterEvent" << event;
-    updateBlur();
     // m_menuButtons->setHovered(true);
 }
 
@@ -352,7 +388,6 @@ void Decoration::hoverMoveEvent(QHoverEvent *event)
     // } else if (wasHovered && contains) {
     //     // HoverMove
     // }
-    updateBlur();
 }
 
 void Decoration::mouseReleaseEvent(QMouseEvent *event)
@@ -361,7 +396,6 @@ void Decoration::mouseReleaseEvent(QMouseEvent *event)
     // qCDebug(category) << "Decoration::mouseReleaseEvent" << event;
 
     resetDragMove();
-    updateBlur();
 }
 
 void Decoration::hoverLeaveEvent(QHoverEvent *event)
@@ -370,7 +404,6 @@ void Decoration::hoverLeaveEvent(QHoverEvent *event)
     qCDebug(category) << "Decoration::hoverLeaveEvent" << event;
 
     resetDragMove();
-    updateBlur();
     // m_menuButtons->setHovered(false);
 }
 
@@ -396,10 +429,33 @@ void Decoration::onSectionUnderMouseChanged(const Qt::WindowFrameSection value)
     updateTitleBarHoverState();
 }
 
+QRegion Decoration::translucentRegion() const
+{
+    QRegion region;
+    if (titleBarBackgroundColor().alpha() < 255) {
+        region += titleBarRect();
+    }
+    if (!m_paintState.shaded && borderColor().alpha() < 255) {
+        const QRect frameRect(0, borderTop(), size().width(), size().height() - borderTop());
+        region += QRegion(frameRect) - rect().marginsRemoved(borders());
+    }
+    return region;
+}
+
 void Decoration::updateBlur()
 {
+    const QRegion region = translucentRegion();
+
+    // Lets KWin skip blending the decoration and whatever is behind it.
+    setOpaque(region.isEmpty());
+
 #if HAVE_KDecoration2_5_25
-    setBlurRegion(QRegion(0, 0, size().width(), size().height()));
+    // Only the parts KWin has to blur behind, the client covers the rest.
+    // Setting the region makes KWin redo the blur, so unchanged regions
+    // are not set again.
+    if (region != blurRegion()) {
+        setBlurRegion(region);
+    }
 #endif
 }
 
@@ -431,6 +487,7 @@ void Decoration::updateResizeBorders()
 void Decoration::updateTitleBar()
 {
     setTitleBar(titleBarRect());
+    invalidateTitleBarLayer();
 }
 
 void Decoration::updateTitleBarHoverState()
@@ -534,7 +591,7 @@ void Decoration::updateButtonsGeometry()
         
     }
 
-    update();
+    scheduleRepaint();
 }
 
 void Decoration::setButtonGroupAnimation(KDecoration2::DecorationButtonGroup *buttonGroup, bool enabled, int duration)
@@ -559,91 +616,52 @@ void Decoration::updateButtonAnimation()
     m_menuButtons->setAnimationDuration(duration);
 }
 
+// The inactive size is a ShadowSize under other names, GlobalEnums does
+// not allow two entries to share their choices.
+static_assert(int(InternalSettings::InactiveShadowNone) == int(InternalSettings::ShadowNone)
+    && int(InternalSettings::InactiveShadowCustom) == int(InternalSettings::ShadowCustom),
+    "InactiveShadowSize has to list the ShadowSize choices in the same order");
+
 void Decoration::updateShadow()
 {
-    const QColor shadowColor = m_internalSettings->shadowColor();
-    const int shadowStrengthInt = m_internalSettings->shadowStrength();
-    const int shadowSizePreset = m_internalSettings->shadowSize();
-
-    if (!s_cachedShadow.isNull()
-        && s_shadowColor == shadowColor
-        && s_shadowSizePreset == shadowSizePreset
-        && s_shadowStrength == shadowStrengthInt
-    ) {
-        setShadow(s_cachedShadow);
-        return;
+    ShadowKey key;
+    key.color = m_internalSettings->shadowColor();
+    key.strength = m_internalSettings->shadowStrength();
+    key.radius = shadowRadius(m_internalSettings->shadowSize(), m_internalSettings->shadowRadius());
+    key.method = m_internalSettings->shadowMethod();
+    key.devicePixelRatio = m_devicePixelRatio;
+    key.downscale = shadowDownscale(m_internalSettings->shadowResolution(), key.radius, m_devicePixelRatio);
+
+    ShadowKey inactiveKey = key;
+    if (!m_internalSettings->inactiveShadowSameAsActive()) {
+        inactiveKey.strength = m_internalSettings->inactiveShadowStrength();
+        inactiveKey.radius = shadowRadius(m_internalSettings->inactiveShadowSize(), m_internalSettings->shadowRadius());
+        inactiveKey.downscale = shadowDownscale(m_internalSettings->shadowResolution(), inactiveKey.radius, m_devicePixelRatio);
     }
 
-    s_shadowColor = shadowColor;
-    s_shadowStrength = shadowStrengthInt;
-    s_shadowSizePreset = shadowSizePreset;
+    // Both are requested up front, so that focus changes never have to
+    // render anything. Shadows that still have to be rendered come with a
+    // placeholder, and shadowReady() calls this again once they are done.
+    ShadowCache *cache = ShadowCache::instance();
+    m_activeShadowKey = key;
+    m_inactiveShadowKey = inactiveKey;
+    m_activeShadow = cache->shadow(key);
+    m_inactiveShadow = cache->shadow(inactiveKey);
 
-    auto withOpacity = [] (const QColor &color, qreal opacity) -> QColor {
-        QColor c(color);
-        c.setAlphaF(opacity);
-        return c;
-    };
-
-    const qreal shadowStrength = static_cast<qreal>(shadowStrengthInt) / 255.0;
-    const CompositeShadowParams params = lookupShadowParams(shadowSizePreset);
+    updateActiveShadow();
+}
 
-    if (params.isNone()) { // InternalSettings::ShadowNone
-        s_cachedShadow.clear();
-        setShadow(s_cachedShadow);
-        return;
+void Decoration::onShadowReady(const ShadowKey &key)
+{
+    // Every decoration hears about every finished shadow.
+    if (key == m_activeShadowKey || key == m_inactiveShadowKey) {
+        updateShadow();
     }
+}
 
-    // In order to properly render a box shadow with a given radius `shadowSize`,
-    // the box size should be at least `2 * QSize(shadowSize, shadowSize)`.
-    const int shadowSize = qMax(params.shadow1.radius, params.shadow2.radius);
-    const QSize boxSize = QSize(1, 1) + QSize(shadowSize*2, shadowSize*2);
-    const QRect box(QPoint(shadowSize, shadowSize), boxSize);
-    const QRect rect = box.adjusted(-shadowSize, -shadowSize, shadowSize, shadowSize);
-
-    QImage shadowTexture(rect.size(), QImage::Format_ARGB32_Premultiplied);
-    shadowTexture.fill(Qt::transparent);
-
-    QPainter painter(&shadowTexture);
-    painter.setRenderHint(QPainter::Antialiasing);
-
-    // Draw the "shape" shadow.
-    BoxShadowHelper::boxShadow(
-        &painter,
-        box,
-        params.shadow1.offset,
-        params.shadow1.radius,
-        withOpacity(shadowColor, params.shadow1.opacity * shadowStrength));
-
-    // Draw the "contrast" shadow.
-    BoxShadowHelper::boxShadow(
-        &painter,
-        box,
-        params.shadow2.offset,
-        params.shadow2.radius,
-        withOpacity(shadowColor, params.shadow2.opacity * shadowStrength));
-
-    // Mask out inner rect.
-    const QMargins padding = QMargins(
-        shadowSize - params.offset.x(),
-        shadowSize - params.offset.y(),
-        shadowSize + params.offset.x(),
-        shadowSize + params.offset.y());
-    const QRect innerRect = rect - padding;
-
-    // Mask out window+titlebar from shadow
-    painter.setPen(Qt::NoPen);
-    painter.setBrush(Qt::black);
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-    painter.drawRect(innerRect);
-
-    painter.end();
-
-    s_cachedShadow = QSharedPointer<KDecoration2::DecorationShadow>::create();
-    s_cachedShadow->setPadding(padding);
-    s_cachedShadow->setInnerShadowRect(QRect(shadowTexture.rect().center(), QSize(1, 1)));
-    s_cachedShadow->setShadow(shadowTexture);
-
-    setShadow(s_cachedShadow);
+void Decoration::updateActiveShadow()
+{
+    setShadow(m_paintState.active ? m_activeShadow : m_inactiveShadow);
 }
 
 bool Decoration::menuAlwaysShow() const
@@ -933,89 +951,295 @@ void Decoration::sendMoveEvent(const QPoint pos)
     }
 }
 
-void Decoration::paintFrameBackground(QPainter *painter, const QRect &repaintRegion) const
+bool Decoration::TitleBarLayerKey::operator==(const TitleBarLayerKey &other) const
 {
-    Q_UNUSED(repaintRegion)
+    return size == other.size
+        && devicePixelRatio == other.devicePixelRatio
+        && foreground == other.foreground
+        && caption == other.caption
+        && font == other.font
+        && painterFont == other.painterFont
+        && titleAlignment == other.titleAlignment
+        && centerRect == other.centerRect
+        && menuGeometry == other.menuGeometry
+        && menuOpacity == other.menuOpacity
+        && menuAlwaysShow == other.menuAlwaysShow
+        && menuOverflowing == other.menuOverflowing
+        && menuVisible == other.menuVisible
+        && menuCaptionSpacing == other.menuCaptionSpacing
+        && renderHints == other.renderHints;
+}
 
-    painter->save();
+Decoration::TitleBarLayerKey Decoration::titleBarLayerKey(const QPainter *painter) const
+{
+    TitleBarLayerKey key;
+    key.size = titleBarRect().size();
+    key.devicePixelRatio = painter->device()->devicePixelRatioF();
+    key.foreground = titleBarForegroundColor();
+    key.caption = m_paintState.caption;
+    key.font = settings()->font();
+    key.painterFont = painter->font();
+    key.titleAlignment = m_internalSettings->titleAlignment();
+    key.centerRect = centerRect();
+    key.menuGeometry = m_menuButtons->geometry();
+    key.menuAlwaysShow = m_menuButtons->alwaysShow();
+    key.menuVisible = !m_menuButtons->buttons().isEmpty();
+    key.menuCaptionSpacing = appMenuCaptionSpacing();
+    key.renderHints = painter->renderHints();
+    if (key.menuVisible) {
+        key.menuOpacity = m_menuButtons->opacity();
+        key.menuOverflowing = m_menuButtons->overflowing();
+    }
+    return key;
+}
 
-    painter->fillRect(rect(), Qt::transparent);
-    painter->setRenderHint(QPainter::Antialiasing);
-    painter->setPen(Qt::NoPen);
-    painter->setBrush(borderColor());
-    painter->setClipRect(0, borderTop(), size().width(), size().height() - borderTop(), Qt::IntersectClip);
-    painter->drawRect(rect());
+void Decoration::paintFrameBackground(QPainter *painter, const QRect &repaintRegion) const
+{
+    // Only the border strips, the client covers the rest. Hidden borders
+    // have no size and are skipped.
+    const int height = size().height() - borderTop();
+    const QRect strips[] = {
+        QRect(0, borderTop(), borderLeft(), height),
+        QRect(size().width() - borderRight(), borderTop(), borderRight(), height),
+        QRect(borderLeft(), size().height() - borderBottom(), size().width() - borderLeft() - borderRight(), borderBottom()),
+    };
 
-    painter->restore();
+    const QColor color = borderColor();
+    for (const QRect &strip : strips) {
+        const QRect damaged = strip & repaintRegion;
+        if (!damaged.isEmpty()) {
+            painter->fillRect(damaged, color);
+        }
+    }
 }
 
-QColor Decoration::borderColor() const
+void Decoration::updatePaintState()
 {
     const auto *decoratedClient = client().toStrongRef().data();
-    const auto group = decoratedClient->isActive()
+
+    PaintState state;
+    state.active = decoratedClient->isActive();
+    state.shaded = decoratedClient->isShaded();
+    state.caption = decoratedClient->caption();
+
+    const auto group = state.active
         ? KDecoration2::ColorGroup::Active
         : KDecoration2::ColorGroup::Inactive;
-    const qreal opacity = decoratedClient->isActive()
+    const qreal opacity = state.active
         ? m_internalSettings->activeOpacity()
         : m_internalSettings->inactiveOpacity();
-    QColor color = decoratedClient->color(group, KDecoration2::ColorRole::Frame);
-    color.setAlphaF(opacity);
-    return color;
+
+    state.border = decoratedClient->color(group, KDecoration2::ColorRole::Frame);
+    state.border.setAlphaF(opacity);
+    state.titleBarBackground = decoratedClient->color(group, KDecoration2::ColorRole::TitleBar);
+    state.titleBarBackground.setAlphaF(opacity);
+    state.titleBarForeground = decoratedClient->color(group, KDecoration2::ColorRole::Foreground);
+    state.warning = decoratedClient->color(KDecoration2::ColorGroup::Warning, KDecoration2::ColorRole::Foreground);
+    state.buttonPressed = KColorUtils::mix(QColor(0, 0, 0, 0), state.titleBarForeground, 0.5);
+    state.menuForeground = KColorUtils::mix(state.titleBarBackground, state.titleBarForeground, 0.8);
+
+    state.closeButtonCircled = m_internalSettings->closeButtonCircle();
+
+    m_paintState = state;
+    invalidateTitleBarLayer();
+}
+
+const Decoration::PaintState &Decoration::paintState() const
+{
+    return m_paintState;
+}
+
+QColor Decoration::borderColor() const
+{
+    return m_paintState.border;
 }
 
 QColor Decoration::titleBarBackgroundColor() const
 {
-    const auto *decoratedClient = client().toStrongRef().data();
-    const auto group = decoratedClient->isActive()
-        ? KDecoration2::ColorGroup::Active
-        : KDecoration2::ColorGroup::Inactive;
-    const qreal opacity = decoratedClient->isActive()
-        ? m_internalSettings->activeOpacity()
-        : m_internalSettings->inactiveOpacity();
-    QColor color = decoratedClient->color(group, KDecoration2::ColorRole::TitleBar);
-    color.setAlphaF(opacity);
-    return color;
+    return m_paintState.titleBarBackground;
 }
 
 QColor Decoration::titleBarForegroundColor() const
 {
-    const auto *decoratedClient = client().toStrongRef().data();
-    const auto group = decoratedClient->isActive()
-        ? KDecoration2::ColorGroup::Active
-        : KDecoration2::ColorGroup::Inactive;
-    return decoratedClient->color(group, KDecoration2::ColorRole::Foreground);
+    return m_paintState.titleBarForeground;
 }
 
-void Decoration::paintTitleBarBackground(QPainter *painter, const QRect &repaintRegion) const
+void Decoration::invalidateTitleBarLayer()
 {
-    Q_UNUSED(repaintRegion)
+    m_titleBarLayerDirty = true;
+}
 
-    painter->save();
-    painter->setPen(Qt::NoPen);
-    painter->setBrush(titleBarBackgroundColor());
-    painter->drawRect(QRect(0, 0, size().width(), titleBarHeight()));
-    painter->restore();
+void Decoration::paintTitleBarLayer(QPainter *painter, const QRect &repaintRegion)
+{
+    // The painter is the only input without a signal. Its fonts are
+    // usually shared, which makes comparing them cheap.
+    const bool painterChanged = painter->device()->devicePixelRatioF() != m_titleBarLayerKey.devicePixelRatio
+        || painter->renderHints() != m_titleBarLayerKey.renderHints
+        || painter->font() != m_titleBarLayerKey.painterFont;
+    if (m_titleBarLayerDirty || painterChanged) {
+        m_titleBarLayerDirty = false;
+        updateTitleBarLayer(titleBarLayerKey(painter));
+    }
+
+    // The layer only covers the caption, its offset is where it starts.
+    if (m_titleBarLayer.isNull()) {
+        return;
+    }
+    const QRect layerRect(titleBarRect().topLeft() + m_titleBarLayer.offset(),
+        m_titleBarLayer.size() / m_titleBarLayerKey.devicePixelRatio);
+    if (repaintRegion.intersects(layerRect)) {
+        painter->drawImage(layerRect.topLeft(), m_titleBarLayer);
+    }
+}
+
+void Decoration::updateTitleBarLayer(const TitleBarLayerKey &key)
+{
+    // The key's scale is only set once a layer was rendered for it.
+    const bool rendered = m_titleBarLayerKey.devicePixelRatio > 0;
+    if (rendered && key == m_titleBarLayerKey) {
+        // Back to what is on screen, whatever is rendering is stale.
+        cancelTitleBarJob();
+        return;
+    }
+
+    // The previous layer stays on screen until the new one is done, which
+    // only works if the title bar kept its size. Painting text off the
+    // main thread is not supported by every platform.
+    const bool layerFits = rendered
+        && key.size == m_titleBarLayerKey.size
+        && key.devicePixelRatio == m_titleBarLayerKey.devicePixelRatio;
+    if (m_internalSettings->renderTitleBarInBackground()
+        && layerFits
+        && QFontDatabase::supportsThreadedFontRendering()
+    ) {
+        startTitleBarJob(key);
+    } else {
+        cancelTitleBarJob();
+        m_titleBarLayerKey = key;
+        m_titleBarLayer = renderTitleBarLayer(key, m_captionLayout);
+    }
 }
 
-void Decoration::paintCaption(QPainter *painter, const QRect &repaintRegion) const
+QImage Decoration::renderTitleBarLayer(const TitleBarLayerKey &key, CaptionLayout &layout)
 {
-    Q_UNUSED(repaintRegion)
+    if (key.titleAlignment == InternalSettings::TitleHidden
+        || !key.centerRect.intersects(QRect(QPoint(0, 0), key.size))
+    ) {
+        return QImage();
+    }
+    updateCaptionLayout(key, layout);
+
+    // Only the caption's own rect is allocated and blended, the rest of
+    // the title bar would be transparent. The margin is for glyphs that
+    // reach past their advance.
+    const int margin = 2;
+    const QRect captionRect = QRectF(layout.position, layout.text.size()).toAlignedRect()
+        .adjusted(-margin, -margin, margin, margin)
+        & QRect(QPoint(0, 0), key.size);
+    if (captionRect.isEmpty()) {
+        return QImage();
+    }
+
+    QImage layer(captionRect.size() * key.devicePixelRatio, QImage::Format_ARGB32_Premultiplied);
+    layer.setDevicePixelRatio(key.devicePixelRatio);
+    layer.setOffset(captionRect.topLeft());
+    layer.fill(Qt::transparent);
+
+    // The caption is painted with source over onto a transparent layer, so
+    // blending the layer gives the same pixels as painting it directly.
+    QPainter painter(&layer);
+    painter.setRenderHints(key.renderHints);
+    painter.setFont(key.painterFont);
+    painter.translate(-captionRect.topLeft());
+    paintCaption(&painter, key, layout);
+    return layer;
+}
 
-    if (m_internalSettings->titleAlignment() == InternalSettings::TitleHidden) {
+void Decoration::startTitleBarJob(const TitleBarLayerKey &key)
+{
+    if (m_titleBarJob && m_titleBarJob->key == key) {
         return;
     }
 
-    const auto *decoratedClient = client().toStrongRef().data();
+    // Only the latest state is worth finishing.
+    cancelTitleBarJob();
+    const auto job = QSharedPointer<TitleBarJob>::create();
+    job->key = key;
+    m_titleBarJob = job;
+
+    s_titleBarThreadPool->start([this, job] {
+        if (job->cancelled) {
+            return;
+        }
+        // The worker lays out the caption itself, the QStaticText of the
+        // main thread is never shared with it.
+        CaptionLayout layout;
+        const QImage layer = renderTitleBarLayer(job->key, layout);
+        if (job->cancelled) {
+            return;
+        }
+
+        // The decoration may be gone by the time the layer is done, but it
+        // cancels its job before, so the application delivers it instead.
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [this, job, layer] {
+            if (!job->cancelled) {
+                finishTitleBarJob(job, layer);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void Decoration::finishTitleBarJob(const QSharedPointer<TitleBarJob> &job, const QImage &layer)
+{
+    m_titleBarJob.clear();
+    m_titleBarLayerKey = job->key;
+    m_titleBarLayer = layer;
+    scheduleRepaint(titleBarRect());
+}
+
+void Decoration::cancelTitleBarJob()
+{
+    if (m_titleBarJob) {
+        m_titleBarJob->cancelled = true;
+        m_titleBarJob.clear();
+    }
+}
 
-    const int textWidth = settings()->fontMetrics().boundingRect(decoratedClient->caption()).width();
-    const QRect textRect((size().width() - textWidth) / 2, 0, textWidth, titleBarHeight());
+void Decoration::paintTitleBarBackground(QPainter *painter, const QRect &repaintRegion) const
+{
+    const QRect backgroundRect = titleBarRect() & repaintRegion;
+    if (backgroundRect.isEmpty()) {
+        return;
+    }
+
+    painter->fillRect(backgroundRect, titleBarBackgroundColor());
+}
+
+void Decoration::updateCaptionLayout(const TitleBarLayerKey &key, CaptionLayout &layout)
+{
+    // Colors, the scale and the menu's fade don't move the caption, so
+    // they are left out of its key.
+    TitleBarLayerKey layoutKey = key;
+    layoutKey.devicePixelRatio = 0;
+    layoutKey.foreground = QColor();
+    layoutKey.menuOpacity = 0;
+    layoutKey.menuOverflowing = false;
+    layoutKey.renderHints = QPainter::RenderHints();
+    if (!layout.text.text().isNull() && layoutKey == layout.key) {
+        return;
+    }
+
+    layout.key = layoutKey;
+    layout.fadeColor = QColor();
+
+    const int textWidth = QFontMetrics(key.font).boundingRect(key.caption).width();
+    layout.textRect = QRect((key.size.width() - textWidth) / 2, 0, textWidth, key.size.height());
 
-    const bool appMenuVisible = !m_menuButtons->buttons().isEmpty();
-    const int menuButtonsWidth = m_menuButtons->geometry().width()
-        + (appMenuVisible ? appMenuCaptionSpacing() : 0);
+    const int menuButtonsWidth = key.menuGeometry.width()
+        + (key.menuVisible ? key.menuCaptionSpacing : 0);
 
-    const QRect availableRect = centerRect().adjusted(
-        (m_menuButtons->alwaysShow() ? menuButtonsWidth : 0),
+    const QRect availableRect = key.centerRect.adjusted(
+        (key.menuAlwaysShow ? menuButtonsWidth : 0),
         0,
         0,
         0
@@ -1024,7 +1248,7 @@ void Decoration::paintCaption(QPainter *painter, const QRect &repaintRegion) con
     QRect captionRect;
     Qt::Alignment alignment;
 
-    switch (m_internalSettings->titleAlignment()) {
+    switch (key.titleAlignment) {
         case InternalSettings::AlignLeft:
             captionRect = availableRect;
             alignment = Qt::AlignLeft | Qt::AlignVCenter;
@@ -1042,59 +1266,87 @@ void Decoration::paintCaption(QPainter *painter, const QRect &repaintRegion) con
 
         default:
         case InternalSettings::AlignCenterFullWidth:
-            if (textRect.left() < availableRect.left()) {
+            if (layout.textRect.left() < availableRect.left()) {
                 captionRect = availableRect;
                 alignment = Qt::AlignLeft | Qt::AlignVCenter;
-            } else if (availableRect.right() < textRect.right()) {
+            } else if (availableRect.right() < layout.textRect.right()) {
                 captionRect = availableRect;
                 alignment = Qt::AlignRight | Qt::AlignVCenter;
             } else {
-                captionRect = titleBarRect();
+                captionRect = QRect(QPoint(0, 0), key.size);
                 alignment = Qt::AlignCenter;
             }
             break;
     }
 
-    const QString caption = painter->fontMetrics().elidedText(
-        decoratedClient->caption(), Qt::ElideMiddle, captionRect.width());
+    // Shaped once here, painting only draws the glyph runs. Captions are
+    // never markup.
+    layout.text.setTextFormat(Qt::PlainText);
+    layout.text.setText(QFontMetrics(key.painterFont).elidedText(
+        key.caption, Qt::ElideMiddle, captionRect.width()));
+    layout.text.prepare(QTransform(), key.font);
+
+    const QSizeF textSize = layout.text.size();
+    qreal x = captionRect.left();
+    if (alignment & Qt::AlignRight) {
+        x = captionRect.left() + captionRect.width() - textSize.width();
+    } else if (alignment & Qt::AlignHCenter) {
+        x = captionRect.left() + (captionRect.width() - textSize.width()) / 2;
+    }
+    layout.position = QPointF(x, captionRect.top() + (captionRect.height() - textSize.height()) / 2);
+}
+
+void Decoration::paintCaption(QPainter *painter, const TitleBarLayerKey &key, CaptionLayout &layout)
+{
+    if (key.titleAlignment == InternalSettings::TitleHidden
+        || !key.centerRect.intersects(QRect(QPoint(0, 0), key.size))
+    ) {
+        return;
+    }
+
+    updateCaptionLayout(key, layout);
+    const QRect &textRect = layout.textRect;
+    const QColor foreground = key.foreground;
 
     painter->save();
-    painter->setFont(settings()->font());
+    painter->setFont(key.font);
 
-    if (m_menuButtons->buttons().isEmpty()) {
-        painter->setPen(titleBarForegroundColor());
+    if (!key.menuVisible) {
+        painter->setPen(foreground);
     } else { // menuButtons is visible
-        const int menuRight = m_menuButtons->geometry().right();
+        const int menuRight = key.menuGeometry.right();
         const int textLeft = textRect.left();
         const int textRight = textRect.right();
         // qCDebug(category) << "textLeft" << textLeft << "menuRight" << menuRight;
 
-        if (!m_menuButtons->alwaysShow()) { // caption fades away revealing menu
-            painter->setOpacity(1.0 - m_menuButtons->opacity());
-            painter->setPen(titleBarForegroundColor());
-        } else if (m_menuButtons->overflowing()) { // hide caption leaving "whitespace" to easily grab.
+        if (!key.menuAlwaysShow) { // caption fades away revealing menu
+            painter->setOpacity(1.0 - key.menuOpacity);
+            painter->setPen(foreground);
+        } else if (key.menuOverflowing) { // hide caption leaving "whitespace" to easily grab.
             painter->setPen(Qt::transparent);
         } else if (textRight < menuRight) { // menuButtons completely coveres caption
             painter->setPen(Qt::transparent);
         } else if (textLeft < menuRight) { // menuButtons covers caption
-            const int fadeWidth = 10; // TODO: scale by dpi
-            const int x1 = menuRight;
-            const int x2 = qMin(x1+fadeWidth, textRight);
-            const float x1Ratio = (float)(x1-textLeft) / (float)textWidth;
-            const float x2Ratio = (float)(x2-textLeft) / (float)textWidth;
-            // qCDebug(category) << "    " << "x2" << x2 << "x1R" << x1Ratio << "x2R" << x2Ratio;
-            QLinearGradient gradient(textRect.topLeft(), textRect.bottomRight());
-            gradient.setColorAt(x1Ratio, Qt::transparent);
-            gradient.setColorAt(x2Ratio, titleBarForegroundColor());
-            QBrush brush(gradient);
-            QPen pen(brush, 1);
-            painter->setPen(pen);
+            if (layout.fadeColor != foreground) {
+                const int fadeWidth = 10; // TODO: scale by dpi
+                const int x1 = menuRight;
+                const int x2 = qMin(x1+fadeWidth, textRight);
+                const float x1Ratio = (float)(x1-textLeft) / (float)textRect.width();
+                const float x2Ratio = (float)(x2-textLeft) / (float)textRect.width();
+                // qCDebug(category) << "    " << "x2" << x2 << "x1R" << x1Ratio << "x2R" << x2Ratio;
+                QLinearGradient gradient(textRect.topLeft(), textRect.bottomRight());
+                gradient.setColorAt(x1Ratio, Qt::transparent);
+                gradient.setColorAt(x2Ratio, foreground);
+                layout.fadeBrush = QBrush(gradient);
+                layout.fadeColor = foreground;
+            }
+            painter->setPen(QPen(layout.fadeBrush, 1));
         } else { // caption is not covered by menuButtons
-            painter->setPen(titleBarForegroundColor());
+            painter->setPen(foreground);
         }
     }
 
-    painter->drawText(captionRect, alignment, caption);
+    painter->drawStaticText(layout.position, layout.text);
     painter->restore();
 }
 
@@ -1107,7 +1359,10 @@ void Decoration::paintButtons(QPainter *painter, const QRect &repaintRegion) con
 
 void Decoration::paintOutline(QPainter *painter, const QRect &repaintRegion) const
 {
-    Q_UNUSED(repaintRegion)
+    // Damage that does not touch the edges, like a button hover.
+    if (rect().adjusted(1, 1, -1, -1).contains(repaintRegion)) {
+        return;
+    }
 
     // Simple 1px border outline
     painter->save();
@@ -1120,9 +1375,9 @@ void Decoration::paintOutline(QPainter *painter, const QRect &repaintRegion) con
     painter->restore();
 }
 
-bool Decoration::isCloseButtonCircled() 
+bool Decoration::isCloseButtonCircled() const
 {
-    return this->m_internalSettings->closeButtonCircle();
+    return m_paintState.closeButtonCircled;
 }
 
 } // namespace Material
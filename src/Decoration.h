@@ -22,17 +22,26 @@
 #include "BuildConfig.h"
 #include "AppMenuButtonGroup.h"
 #include "InternalSettings.h"
+#include "ShadowCache.h"
 
 // KDecoration
 #include <KDecoration2/Decoration>
 #include <KDecoration2/DecorationButton>
 #include <KDecoration2/DecorationButtonGroup>
+#include <KDecoration2/DecorationShadow>
 
 // Qt
+#include <QBrush>
+#include <QColor>
+#include <QFont>
 #include <QHoverEvent>
+#include <QImage>
 #include <QMouseEvent>
+#include <QPainter>
 #include <QRectF>
+#include <QRegion>
 #include <QSharedPointer>
+#include <QStaticText>
 #include <QWheelEvent>
 #include <QVariant>
 
@@ -61,7 +70,35 @@ public:
 
     void paint(QPainter *painter, const QRect &repaintRegion) override;
 
-    bool isCloseButtonCircled();
+    // Merges the rect into the damage that is repainted once the current
+    // burst of changes is over, instead of calling update() right away.
+    void scheduleRepaint(const QRect &rect);
+    void scheduleRepaint();
+    // Repaint requests that were merged into an earlier one.
+    int coalescedRepaints() const;
+
+    bool isCloseButtonCircled() const;
+
+    // What painting needs from the client and the settings, resolved once
+    // whenever one of them changes instead of on every paint.
+    struct PaintState
+    {
+        bool active = false;
+        bool shaded = false;
+        QString caption;
+
+        QColor border;
+        QColor titleBarBackground;
+        QColor titleBarForeground;
+        QColor warning;
+        // Background of pressed buttons.
+        QColor buttonPressed;
+        // Entries of the app menu while another one is open.
+        QColor menuForeground;
+
+        bool closeButtonCircled = false;
+    };
+    const PaintState &paintState() const;
 
 public slots:
     void init() override;
@@ -77,8 +114,12 @@ protected:
 
 private slots:
     void onSectionUnderMouseChanged(const Qt::WindowFrameSection value);
+    void onShadowReady(const ShadowKey &key);
 
 private:
+    void flushRepaints();
+    void updatePaintState();
+    QRegion translucentRegion() const;
     void updateBlur();
     void updateBorders();
     void updateResizeBorders();
@@ -92,6 +133,7 @@ private:
     void setButtonGroupAnimation(KDecoration2::DecorationButtonGroup *buttonGroup, bool enabled, int duration);
     void updateButtonAnimation();
     void updateShadow();
+    void updateActiveShadow();
 
     bool menuAlwaysShow() const;
     bool animationsEnabled() const;
@@ -123,9 +165,61 @@ private:
     QColor titleBarBackgroundColor() const;
     QColor titleBarForegroundColor() const;
 
+    // Everything the caption depends on. It is painted into a layer that
+    // is reused until one of these changes, so hovering a button only
+    // repaints the button and blits the caption over it again.
+    struct TitleBarLayerKey
+    {
+        QSize size;
+        qreal devicePixelRatio = 0;
+        QColor foreground;
+        QString caption;
+        QFont font;
+        QFont painterFont;
+        int titleAlignment = 0;
+        QRect centerRect;
+        QRectF menuGeometry;
+        qreal menuOpacity = 0;
+        bool menuAlwaysShow = false;
+        bool menuOverflowing = false;
+        bool menuVisible = false;
+        int menuCaptionSpacing = 0;
+        QPainter::RenderHints renderHints;
+
+        bool operator==(const TitleBarLayerKey &other) const;
+    };
+    TitleBarLayerKey titleBarLayerKey(const QPainter *painter) const;
+    // Called from the slots of everything the key depends on, the key is
+    // only built again on the next paint after that.
+    void invalidateTitleBarLayer();
+    void updateTitleBarLayer(const TitleBarLayerKey &key);
+
+    // The caption shaped and placed for the title bar it was laid out in.
+    // Only the caption, the fonts and the title bar's layout change it.
+    struct CaptionLayout
+    {
+        TitleBarLayerKey key;
+        QRect textRect;
+        QStaticText text;
+        QPointF position;
+        // The fade under the app menu, for the color it was built with.
+        QColor fadeColor;
+        QBrush fadeBrush;
+    };
+    static void updateCaptionLayout(const TitleBarLayerKey &key, CaptionLayout &layout);
+
+    // Paints the layer from the key and the layout alone, so that it can
+    // be rendered on any thread.
+    static QImage renderTitleBarLayer(const TitleBarLayerKey &key, CaptionLayout &layout);
+    struct TitleBarJob;
+    void startTitleBarJob(const TitleBarLayerKey &key);
+    void finishTitleBarJob(const QSharedPointer<TitleBarJob> &job, const QImage &layer);
+    void cancelTitleBarJob();
+
     void paintFrameBackground(QPainter *painter, const QRect &repaintRegion) const;
+    void paintTitleBarLayer(QPainter *painter, const QRect &repaintRegion);
     void paintTitleBarBackground(QPainter *painter, const QRect &repaintRegion) const;
-    void paintCaption(QPainter *painter, const QRect &repaintRegion) const;
+    static void paintCaption(QPainter *painter, const TitleBarLayerKey &key, CaptionLayout &layout);
     void paintButtons(QPainter *painter, const QRect &repaintRegion) const;
     void paintOutline(QPainter *painter, const QRect &repaintRegion) const;
 
@@ -135,7 +229,30 @@ private:
 
     QSharedPointer<InternalSettings> m_internalSettings;
 
+    PaintState m_paintState;
+
+    QRegion m_pendingRepaint;
+    bool m_repaintScheduled = false;
+    int m_repaintRequests = 0;
+    int m_repaintFlushes = 0;
+
     QPoint m_pressedPoint;
+    qreal m_devicePixelRatio = 1;
+
+    // Shared with every other decoration through the ShadowCache, focus
+    // changes only switch between them.
+    QSharedPointer<KDecoration2::DecorationShadow> m_activeShadow;
+    QSharedPointer<KDecoration2::DecorationShadow> m_inactiveShadow;
+    ShadowKey m_activeShadowKey;
+    ShadowKey m_inactiveShadowKey;
+
+    TitleBarLayerKey m_titleBarLayerKey;
+    QImage m_titleBarLayer;
+    bool m_titleBarLayerDirty = true;
+    CaptionLayout m_captionLayout;
+    // Renders the replacement of m_titleBarLayer in the background, which
+    // is only swapped in once it is complete.
+    QSharedPointer<TitleBarJob> m_titleBarJob;
 
 #if HAVE_X11
     xcb_atom_t m_moveResizeAtom = 0;
@@ -0,0 +1,545 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "ShadowCache.h"
+#include "Material.h"
+#include "BoxShadowHelper.h"
+#include "InternalSettings.h"
+#include "ShadowDiskCache.h"
+#include "ShadowKernels.h"
+
+// Qt
+#include <QDebug>
+#include <QHash>
+#include <QImage>
+
+// std
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+namespace Material
+{
+
+namespace
+{
+
+struct ShadowParams
+{
+    ShadowParams() = default;
+
+    ShadowParams(const QPoint &offset, int radius, qreal opacity)
+        : offset(offset)
+        , radius(radius)
+        , opacity(opacity) {}
+
+    QPoint offset;
+    int radius = 0;
+    qreal opacity = 0;
+};
+
+struct CompositeShadowParams
+{
+    CompositeShadowParams() = default;
+
+    CompositeShadowParams(
+            const QPoint &offset,
+            const ShadowParams &shadow1,
+            const ShadowParams &shadow2)
+        : offset(offset)
+        , shadow1(shadow1)
+        , shadow2(shadow2) {}
+
+    bool isNone() const {
+        return qMax(shadow1.radius, shadow2.radius) == 0;
+    }
+
+    QPoint offset;
+    ShadowParams shadow1;
+    ShadowParams shadow2;
+};
+
+// const CompositeShadowParams s_shadowParams = CompositeShadowParams(
+//     QPoint(0, 18),
+//     ShadowParams(QPoint(0, 0), 64, 0.8),
+//     ShadowParams(QPoint(0, -10), 24, 0.1)
+// );
+
+// Blurs narrower than this many device pixels are rendered at a higher
+// resolution than requested.
+const int MIN_REDUCED_BLUR_RADIUS = 8;
+
+// The ShadowSize presets are radii, in the order of the choices.
+const int s_presetRadii[] = {
+    0,  // None
+    16, // Small
+    32, // Medium
+    48, // Large
+    64, // Very large
+};
+
+// Every preset used to have its own params, and they all follow from the
+// radius of the "shape" shadow. The "contrast" shadow is half as large
+// and both fade out as the shadow grows.
+CompositeShadowParams shadowParams(int radius)
+{
+    if (radius <= 0) {
+        return CompositeShadowParams();
+    }
+
+    return CompositeShadowParams(
+        QPoint(0, radius / 4),
+        ShadowParams(QPoint(0, 0), radius, qBound(0.0, 1.1 - radius / 160.0, 1.0)),
+        ShadowParams(QPoint(0, -radius / 8), radius / 2, qMax(0.0, 0.5 - radius / 160.0)));
+}
+
+int maxShadowRadius(const CompositeShadowParams &params)
+{
+    return qMax(params.shadow1.radius, params.shadow2.radius);
+}
+
+QMargins shadowPadding(const CompositeShadowParams &params)
+{
+    const int size = maxShadowRadius(params);
+    return QMargins(
+        size - params.offset.x(),
+        size - params.offset.y(),
+        size + params.offset.x(),
+        size + params.offset.y());
+}
+
+// In order to properly render a box shadow with a given radius `shadowSize`,
+// the box size should be at least `2 * QSize(shadowSize, shadowSize)`.
+QRect shadowBox(const CompositeShadowParams &params)
+{
+    const int shadowSize = maxShadowRadius(params);
+    const QSize boxSize = QSize(1, 1) + QSize(shadowSize*2, shadowSize*2);
+    return QRect(QPoint(shadowSize, shadowSize), boxSize);
+}
+
+QRect shadowRect(const CompositeShadowParams &params)
+{
+    const int shadowSize = maxShadowRadius(params);
+    return shadowBox(params).adjusted(-shadowSize, -shadowSize, shadowSize, shadowSize);
+}
+
+// Mask out window+titlebar from shadow
+void maskOutInnerRect(ShadowMask &mask, const CompositeShadowParams &params, qreal scale)
+{
+    const QRect innerRect = shadowRect(params) - shadowPadding(params);
+    const QRect deviceInnerRect = QRect(
+        QPoint(qRound(innerRect.left() * scale), qRound(innerRect.top() * scale)),
+        QPoint(qRound((innerRect.right() + 1) * scale) - 1, qRound((innerRect.bottom() + 1) * scale) - 1))
+        & mask.shape.rect();
+    for (int y = deviceInnerRect.top(); y <= deviceInnerRect.bottom(); ++y) {
+        std::memset(mask.shape.scanLine(y) + deviceInnerRect.left(), 0, deviceInnerRect.width());
+        std::memset(mask.contrast.scanLine(y) + deviceInnerRect.left(), 0, deviceInnerRect.width());
+    }
+}
+
+// The masks are rendered at the scale of the output, reduced by the
+// downscale of the key. Padding and geometry stay in logical pixels.
+ShadowMask renderShadowMask(const ShadowKey &key, const CompositeShadowParams &params)
+{
+    const qreal scale = key.devicePixelRatio / key.downscale;
+    const BoxShadowHelper::Method method = key.method == InternalSettings::ShadowBoxBlur
+        ? BoxShadowHelper::Method::BoxBlur
+        : BoxShadowHelper::Method::Analytic;
+
+    const QRect box = shadowBox(params);
+
+    ShadowMask mask;
+    mask.shape = QImage(shadowRect(params).size() * scale, QImage::Format_Alpha8);
+    mask.shape.fill(0);
+    mask.contrast = mask.shape.copy();
+
+    // The "shape" shadow.
+    BoxShadowHelper::boxShadowMask(mask.shape, scale, box,
+        params.shadow1.offset, params.shadow1.radius, method);
+
+    // The "contrast" shadow.
+    BoxShadowHelper::boxShadowMask(mask.contrast, scale, box,
+        params.shadow2.offset, params.shadow2.radius, method);
+
+    maskOutInnerRect(mask, params, scale);
+
+    return mask;
+}
+
+// Colors the masks, this is all that changes with the color and the
+// strength of the shadow.
+QImage tintShadowMask(const ShadowKey &key, const CompositeShadowParams &params, const ShadowMask &reducedMask)
+{
+    // Reduced masks are scaled up first, KWin always gets a texture at the
+    // scale of the output. Scaling blurs the edges of the inner rect, so it
+    // is masked out again.
+    ShadowMask mask = reducedMask;
+    if (key.downscale > 1) {
+        const QSize size = shadowRect(params).size() * key.devicePixelRatio;
+        mask.shape = BoxShadowHelper::upscaleMask(reducedMask.shape, size);
+        mask.contrast = BoxShadowHelper::upscaleMask(reducedMask.contrast, size);
+        maskOutInnerRect(mask, params, key.devicePixelRatio);
+    }
+
+    auto scaledOpacity = [&key] (qreal opacity) -> int {
+        return qBound(0, qRound(opacity * key.strength), 255) * 256 / 255;
+    };
+
+    QImage shadowTexture(mask.shape.size(), QImage::Format_ARGB32_Premultiplied);
+    shadowTexture.setDevicePixelRatio(key.devicePixelRatio);
+
+    const int shapeOpacity = scaledOpacity(params.shadow1.opacity);
+    const int contrastOpacity = scaledOpacity(params.shadow2.opacity);
+    const quint32 rgb = key.color.rgb() & 0xffffff;
+    for (int y = 0; y < shadowTexture.height(); ++y) {
+        ShadowKernels::tint(
+            mask.shape.constScanLine(y),
+            mask.contrast.constScanLine(y),
+            reinterpret_cast<quint32 *>(shadowTexture.scanLine(y)),
+            shadowTexture.width(),
+            shapeOpacity,
+            contrastOpacity,
+            rgb);
+    }
+
+    return shadowTexture;
+}
+
+// The masks do not depend on the color and the strength.
+ShadowKey maskKey(const ShadowKey &key)
+{
+    ShadowKey masked = key;
+    masked.color = QColor();
+    masked.strength = 0;
+    return masked;
+}
+
+// Whether two keys only differ by the output they are rendered for. The
+// downscale follows from the resolution setting, so a job for another
+// resolution is stale as well.
+bool sameSettings(const ShadowKey &a, const ShadowKey &b)
+{
+    return a.color == b.color
+        && a.strength == b.strength
+        && a.radius == b.radius
+        && a.method == b.method
+        && a.downscale == b.downscale;
+}
+
+int costOf(const QImage &image)
+{
+    return static_cast<int>(image.sizeInBytes() / 1024);
+}
+
+QSharedPointer<KDecoration2::DecorationShadow> createShadow(const CompositeShadowParams &params, const QImage &texture)
+{
+    auto shadow = QSharedPointer<KDecoration2::DecorationShadow>::create();
+    shadow->setPadding(shadowPadding(params));
+    shadow->setInnerShadowRect(QRect(texture.rect().center(), QSize(1, 1)));
+    shadow->setShadow(texture);
+    return shadow;
+}
+
+} // anonymous namespace
+
+Q_GLOBAL_STATIC(ShadowCache, s_shadowCache)
+
+int shadowRadius(int sizePreset, int customRadius)
+{
+    if (sizePreset == InternalSettings::ShadowCustom) {
+        return customRadius;
+    }
+    if (sizePreset < 0 || sizePreset >= int(sizeof(s_presetRadii) / sizeof(s_presetRadii[0]))) {
+        return s_presetRadii[InternalSettings::ShadowLarge];
+    }
+    return s_presetRadii[sizePreset];
+}
+
+int shadowDownscale(int resolution, int radius, qreal devicePixelRatio)
+{
+    int downscale = 1;
+    if (resolution == InternalSettings::ShadowQuarterResolution) {
+        downscale = 4;
+    } else if (resolution == InternalSettings::ShadowHalfResolution) {
+        downscale = 2;
+    }
+
+    // Small blurs lose too much at a lower resolution. The "contrast"
+    // shadow has half the radius, it has to stay wide enough too.
+    while (downscale > 1 && radius / 2 * devicePixelRatio / downscale < MIN_REDUCED_BLUR_RADIUS) {
+        downscale /= 2;
+    }
+    return downscale;
+}
+
+bool ShadowKey::operator==(const ShadowKey &other) const
+{
+    return color == other.color
+        && strength == other.strength
+        && radius == other.radius
+        && method == other.method
+        && devicePixelRatio == other.devicePixelRatio
+        && downscale == other.downscale;
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+size_t qHash(const ShadowKey &key, size_t seed)
+#else
+uint qHash(const ShadowKey &key, uint seed)
+#endif
+{
+    seed ^= ::qHash(key.color.rgba()) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.strength) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.radius) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.method) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.devicePixelRatio) + (seed << 6) + (seed >> 2);
+    seed ^= ::qHash(key.downscale) + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+struct ShadowCache::Job
+{
+    std::atomic<bool> cancelled{false};
+};
+
+ShadowCache::ShadowCache()
+{
+    m_shadows.setMaxCost(MAX_COST);
+    m_masks.setMaxCost(MAX_MASK_COST);
+
+    // Jobs are cheap to cancel while they wait, and the blur itself is
+    // already split across threads.
+    m_threadPool.setMaxThreadCount(1);
+}
+
+ShadowCache::~ShadowCache()
+{
+    cancelJobs();
+    m_threadPool.waitForDone();
+}
+
+ShadowCache *ShadowCache::instance()
+{
+    return s_shadowCache();
+}
+
+QImage ShadowCache::render(const ShadowKey &key)
+{
+    const CompositeShadowParams params = shadowParams(key.radius);
+    if (params.isNone()) { // InternalSettings::ShadowNone
+        return QImage();
+    }
+    return tintShadowMask(key, params, renderShadowMask(key, params));
+}
+
+QSharedPointer<KDecoration2::DecorationShadow> ShadowCache::shadow(const ShadowKey &key)
+{
+    const ShadowKey previousRequest = std::exchange(m_previousRequest, key);
+
+    if (const auto *cached = m_shadows.object(key)) {
+        ++m_hits;
+        return *cached;
+    }
+
+    // Already being rendered, which the disk cache had no file for.
+    if (m_jobs.contains(key)) {
+        return placeholder(key);
+    }
+
+    ++m_misses;
+
+    const CompositeShadowParams params = shadowParams(key.radius);
+    if (params.isNone()) { // InternalSettings::ShadowNone
+        insert(key, QSharedPointer<KDecoration2::DecorationShadow>());
+        return QSharedPointer<KDecoration2::DecorationShadow>();
+    }
+
+    // Mapping a texture that was rendered before is cheap enough to do
+    // right away, only rendering is moved off this thread.
+    quint32 checksum = 0;
+    QImage texture = ShadowDiskCache::load(key, &checksum);
+    if (!texture.isNull()) {
+        const QSharedPointer<KDecoration2::DecorationShadow> shadow = createShadow(params, texture);
+        insert(key, shadow);
+        verifyLoaded(key, texture, checksum);
+        return shadow;
+    }
+
+    // So is tinting the masks when only the color or the strength changed,
+    // which keeps dragging those settings in the KCM smooth.
+    if (const ShadowMask *mask = m_masks.object(maskKey(key))) {
+        texture = tintShadowMask(key, params, *mask);
+        m_threadPool.start([key, texture] {
+            ShadowDiskCache::store(key, texture);
+        });
+
+        const QSharedPointer<KDecoration2::DecorationShadow> shadow = createShadow(params, texture);
+        insert(key, shadow);
+        return shadow;
+    }
+
+    startJob(key, previousRequest);
+    return placeholder(key);
+}
+
+void ShadowCache::clear()
+{
+    cancelJobs();
+    m_shadows.clear();
+    m_masks.clear();
+}
+
+void ShadowCache::insert(const ShadowKey &key, const QSharedPointer<KDecoration2::DecorationShadow> &shadow)
+{
+    const int cost = shadow ? costOf(shadow->shadow()) : 0;
+    m_shadows.insert(key, new QSharedPointer<KDecoration2::DecorationShadow>(shadow), cost);
+
+    qCDebug(category) << "ShadowCache insert" << "dpr" << key.devicePixelRatio << "radius" << key.radius
+        << "hits" << m_hits << "misses" << m_misses;
+}
+
+QSharedPointer<KDecoration2::DecorationShadow> ShadowCache::placeholder(const ShadowKey &key)
+{
+    // A shadow for another output scale or method would be visibly off,
+    // the closest size and strength among the others is good enough for
+    // the moment the job takes.
+    ShadowKey nearest;
+    int nearestDistance = -1;
+    const QList<ShadowKey> keys = m_shadows.keys();
+    for (const ShadowKey &other : keys) {
+        if (other.devicePixelRatio != key.devicePixelRatio
+            || other.method != key.method
+            || other.radius == 0
+        ) {
+            continue;
+        }
+        const int distance = 256 * qAbs(other.radius - key.radius) + qAbs(other.strength - key.strength);
+        if (nearestDistance < 0 || distance < nearestDistance) {
+            nearest = other;
+            nearestDistance = distance;
+        }
+    }
+
+    if (nearestDistance < 0) {
+        return QSharedPointer<KDecoration2::DecorationShadow>();
+    }
+    return *m_shadows.object(nearest);
+}
+
+void ShadowCache::verifyLoaded(const ShadowKey &key, const QImage &texture, quint32 checksum)
+{
+    // Reading the pixels faults in the whole mapping, so a damaged file is
+    // only noticed once the texture is in use. It is rendered again then.
+    // The texture is always handed back, so that the mapping and the QFile
+    // behind it are released on this thread.
+    m_threadPool.start([this, key, texture, checksum] {
+        const bool valid = ShadowDiskCache::verify(texture, checksum);
+        if (!valid) {
+            ShadowDiskCache::remove(key);
+        }
+
+        QMetaObject::invokeMethod(this, [this, key, texture, valid] {
+            if (valid) {
+                return;
+            }
+            // The entry may have been dropped or replaced meanwhile.
+            const auto *cached = m_shadows.object(key);
+            if (cached && *cached && (*cached)->shadow().constBits() == texture.constBits()) {
+                m_shadows.remove(key);
+                startJob(key, m_previousRequest);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ShadowCache::startJob(const ShadowKey &key, const ShadowKey &previousRequest)
+{
+    if (m_jobs.contains(key)) {
+        return;
+    }
+
+    // Settings are shared by all decorations, so jobs for other settings
+    // are stale. The previous request is the other window state of the
+    // same decoration, only the output scale may differ otherwise.
+    for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+        const ShadowKey &other = it.key();
+        if (!sameSettings(other, key) && !sameSettings(other, previousRequest)) {
+            it.value()->cancelled = true;
+            it = m_jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    const auto job = QSharedPointer<Job>::create();
+    m_jobs.insert(key, job);
+
+    // Only QImage is used off the main thread, the DecorationShadow is
+    // created once the texture is handed back.
+    m_threadPool.start([this, key, job] {
+        if (job->cancelled) {
+            return;
+        }
+        const CompositeShadowParams params = shadowParams(key.radius);
+        const ShadowMask mask = renderShadowMask(key, params);
+        const QImage texture = tintShadowMask(key, params, mask);
+        if (job->cancelled) {
+            return;
+        }
+        ShadowDiskCache::store(key, texture);
+
+        QMetaObject::invokeMethod(this, [this, key, job, mask, texture] {
+            finishJob(key, job, mask, texture);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ShadowCache::finishJob(const ShadowKey &key, const QSharedPointer<Job> &job,
+                            const ShadowMask &mask, const QImage &texture)
+{
+    if (job->cancelled) {
+        return;
+    }
+
+    m_jobs.remove(key);
+    m_masks.insert(maskKey(key), new ShadowMask(mask), costOf(mask.shape) + costOf(mask.contrast));
+    insert(key, createShadow(shadowParams(key.radius), texture));
+
+    emit shadowReady(key);
+}
+
+void ShadowCache::cancelJobs()
+{
+    for (const auto &job : qAsConst(m_jobs)) {
+        job->cancelled = true;
+    }
+    m_jobs.clear();
+}
+
+int ShadowCache::hits() const
+{
+    return m_hits;
+}
+
+int ShadowCache::misses() const
+{
+    return m_misses;
+}
+
+} // namespace Material
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// KDecoration
+#include <KDecoration2/DecorationShadow>
+
+// Qt
+#include <QCache>
+#include <QColor>
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+namespace Material
+{
+
+struct ShadowKey
+{
+    QColor color;
+    int strength = 255;
+    int radius = 0;
+    int method = 0;
+    qreal devicePixelRatio = 1;
+    // The masks are rendered at 1 / downscale of the output's resolution.
+    int downscale = 1;
+
+    bool operator==(const ShadowKey &other) const;
+};
+
+// The blurred alpha of the two layers of a shadow, in Format_Alpha8. They
+// only depend on the radius, the method and the scales, the color and
+// the strength are applied when they are tinted.
+struct ShadowMask
+{
+    QImage shape;
+    QImage contrast;
+};
+
+// The radius of the "shape" shadow for the ShadowSize setting, the other
+// params follow from it. A radius of 0 means no shadow.
+int shadowRadius(int sizePreset, int customRadius);
+
+// The downscale for the ShadowResolution setting. Shadows too small to be
+// rendered at the requested resolution get a smaller one.
+int shadowDownscale(int resolution, int radius, qreal devicePixelRatio);
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+size_t qHash(const ShadowKey &key, size_t seed = 0);
+#else
+uint qHash(const ShadowKey &key, uint seed = 0);
+#endif
+
+// Shadows shared by all decorations of the process. Every combination of
+// settings and output scale gets its own texture, so active and inactive
+// windows share one unless their settings differ. The
+// least recently used ones are dropped once the textures exceed MAX_COST.
+// The masks behind them are kept too, so that changing the color or the
+// strength only tints them again.
+//
+// Textures that are neither in memory nor on disk are rendered in the
+// background. Until shadowReady() is emitted for the key, the cached
+// shadow closest to it for the same output scale and method is handed
+// out as a placeholder, or none if there is no such shadow. Decorations
+// ask for their active and inactive shadow together, jobs for settings
+// that neither of the last two requests used are cancelled.
+class ShadowCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    ShadowCache();
+    ~ShadowCache() override;
+
+    static ShadowCache *instance();
+
+    // Renders the texture for the key from scratch, without looking at or
+    // filling any of the caches.
+    static QImage render(const ShadowKey &key);
+
+    // Returns a null pointer if the key has no shadow.
+    QSharedPointer<KDecoration2::DecorationShadow> shadow(const ShadowKey &key);
+    void clear();
+
+    int hits() const;
+    int misses() const;
+
+signals:
+    void shadowReady(const ShadowKey &key);
+
+private:
+    struct Job;
+
+    void insert(const ShadowKey &key, const QSharedPointer<KDecoration2::DecorationShadow> &shadow);
+    QSharedPointer<KDecoration2::DecorationShadow> placeholder(const ShadowKey &key);
+    void verifyLoaded(const ShadowKey &key, const QImage &texture, quint32 checksum);
+    void startJob(const ShadowKey &key, const ShadowKey &previousRequest);
+    void finishJob(const ShadowKey &key, const QSharedPointer<Job> &job,
+                   const ShadowMask &mask, const QImage &texture);
+    void cancelJobs();
+
+    // The cost of an entry is the size of its texture in KiB.
+    static const int MAX_COST = 16 * 1024;
+    static const int MAX_MASK_COST = 8 * 1024;
+
+    QCache<ShadowKey, QSharedPointer<KDecoration2::DecorationShadow>> m_shadows;
+    QCache<ShadowKey, ShadowMask> m_masks;
+    QHash<ShadowKey, QSharedPointer<Job>> m_jobs;
+    ShadowKey m_previousRequest;
+    int m_hits = 0;
+    int m_misses = 0;
+
+    // Declared last, so that running jobs finish before anything they
+    // touch is destroyed.
+    QThreadPool m_threadPool;
+};
+
+} // namespace Material
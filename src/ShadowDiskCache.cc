@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "ShadowDiskCache.h"
+#include "Material.h"
+
+// Qt
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// std
+#include <cstring>
+
+
+namespace Material
+{
+namespace ShadowDiskCache
+{
+
+namespace
+{
+const quint32 MAGIC = 0x5744534d; // "MSDW", also rejects files of the other endianness
+
+// Bump whenever the rendered shadows change, so that stale files are
+// regenerated instead of being reused.
+const quint32 VERSION = 5;
+
+// Every color and strength that was ever previewed in the KCM gets a file,
+// only the most recently written ones are kept.
+const int MAX_FILES = 32;
+
+struct Header
+{
+    quint32 magic;
+    quint32 version;
+
+    // The key the texture was rendered for.
+    quint32 color;
+    qint32 strength;
+    qint32 radius;
+    qint32 method;
+    double devicePixelRatio;
+    qint32 downscale;
+
+    qint32 width;
+    qint32 height;
+    quint32 checksum;
+};
+
+// The pixels follow the header and have to stay 4-byte aligned.
+static_assert(sizeof(Header) % 4 == 0, "Shadow cache header breaks pixel alignment");
+
+Header headerFor(const ShadowKey &key)
+{
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.color = key.color.rgba();
+    header.strength = key.strength;
+    header.radius = key.radius;
+    header.method = key.method;
+    header.devicePixelRatio = key.devicePixelRatio;
+    header.downscale = key.downscale;
+    return header;
+}
+
+// Headers are read into a struct that has padding, so they are compared
+// field by field.
+bool sameHeader(const Header &a, const Header &b)
+{
+    return a.magic == b.magic
+        && a.version == b.version
+        && a.color == b.color
+        && a.strength == b.strength
+        && a.radius == b.radius
+        && a.method == b.method
+        && a.devicePixelRatio == b.devicePixelRatio
+        && a.downscale == b.downscale;
+}
+
+// FNV-1a, enough to catch truncated or partially written files.
+quint32 computeChecksum(const uchar *data, qint64 size)
+{
+    quint32 hash = 2166136261u;
+    for (qint64 i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+QString cacheDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/kdecoration_material/shadows");
+}
+
+QString cacheFilePath(const ShadowKey &key)
+{
+    return cacheDirectory() + QStringLiteral("/%1-%2-%3-%4-%5-%6.shadow")
+        .arg(key.color.rgba(), 8, 16, QLatin1Char('0'))
+        .arg(key.strength)
+        .arg(key.radius)
+        .arg(key.method)
+        .arg(qRound(key.devicePixelRatio * 100))
+        .arg(key.downscale);
+}
+
+void unmapFile(void *file)
+{
+    delete static_cast<QFile *>(file);
+}
+
+} // anonymous namespace
+
+QImage load(const ShadowKey &key, quint32 *checksum)
+{
+    auto *file = new QFile(cacheFilePath(key));
+    if (!file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(Header))) {
+        delete file;
+        return QImage();
+    }
+
+    // A private mapping lets the image own writable pixels without ever
+    // touching the file, so setting the device pixel ratio does not copy.
+    uchar *data = file->map(0, file->size(), QFileDevice::MapPrivateOption);
+    if (!data) {
+        delete file;
+        return QImage();
+    }
+
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+
+    // Only the header is read here, touching the pixels would fault in
+    // every page of the mapping on the main thread.
+    uchar *pixels = data + sizeof(Header);
+    const qint64 pixelsSize = file->size() - qint64(sizeof(Header));
+    if (!sameHeader(header, headerFor(key))
+        || header.width <= 0
+        || header.height <= 0
+        || pixelsSize != qint64(header.width) * header.height * 4
+    ) {
+        qCDebug(category) << "ShadowDiskCache discarding" << file->fileName();
+        delete file;
+        return QImage();
+    }
+
+    QImage texture(pixels, header.width, header.height, header.width * 4,
+        QImage::Format_ARGB32_Premultiplied, unmapFile, file);
+    texture.setDevicePixelRatio(key.devicePixelRatio);
+    *checksum = header.checksum;
+    return texture;
+}
+
+bool verify(const QImage &texture, quint32 checksum)
+{
+    return computeChecksum(texture.constBits(), texture.sizeInBytes()) == checksum;
+}
+
+void remove(const ShadowKey &key)
+{
+    qCDebug(category) << "ShadowDiskCache discarding" << cacheFilePath(key);
+    QFile::remove(cacheFilePath(key));
+}
+
+void store(const ShadowKey &key, const QImage &texture)
+{
+    if (texture.isNull() || !QDir().mkpath(cacheDirectory())) {
+        return;
+    }
+
+    const QImage image = texture.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const int rowSize = image.width() * 4;
+
+    QByteArray pixels;
+    pixels.reserve(rowSize * image.height());
+    for (int y = 0; y < image.height(); ++y) {
+        pixels.append(reinterpret_cast<const char *>(image.constScanLine(y)), rowSize);
+    }
+
+    Header header = headerFor(key);
+    header.width = image.width();
+    header.height = image.height();
+    header.checksum = computeChecksum(reinterpret_cast<const uchar *>(pixels.constData()), pixels.size());
+
+    // Other processes may load the file at any time, so it is replaced
+    // atomically rather than written in place.
+    QSaveFile file(cacheFilePath(key));
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+        || file.write(pixels) != pixels.size()
+        || !file.commit()
+    ) {
+        qCDebug(category) << "ShadowDiskCache failed to write" << file.fileName();
+        return;
+    }
+
+    const QFileInfoList files = QDir(cacheDirectory()).entryInfoList(
+        QStringList(QStringLiteral("*.shadow")), QDir::Files, QDir::Time);
+    for (int i = MAX_FILES; i < files.size(); ++i) {
+        QFile::remove(files.at(i).absoluteFilePath());
+    }
+}
+
+} // namespace ShadowDiskCache
+} // namespace Material
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// own
+#include "ShadowCache.h"
+
+// Qt
+#include <QImage>
+
+namespace Material
+{
+namespace ShadowDiskCache
+{
+
+// Shadow textures persisted under the user cache directory, one file per
+// key, so that restarting KWin or loading the plugin in another process
+// does not blur anything again. Files hold a versioned header followed by
+// the raw pixels and are memory mapped when loaded.
+
+// Returns a null image if there is no file for the key or its header does
+// not match. The pixels are not read, their checksum is returned so that
+// verify() can check them off the main thread.
+QImage load(const ShadowKey &key, quint32 *checksum);
+
+// Reads every pixel of a loaded texture.
+bool verify(const QImage &texture, quint32 checksum);
+
+// Drops the file of a texture that failed verify().
+void remove(const ShadowKey &key);
+
+// Failing to write is not an error, the texture is generated again next time.
+void store(const ShadowKey &key, const QImage &texture);
+
+} // namespace ShadowDiskCache
+} // namespace Material
@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "ShadowKernels.h"
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATERIAL_X86_SIMD 1
+#include <immintrin.h>
+#define MATERIAL_TARGET_SSE2 __attribute__((target("sse2")))
+#define MATERIAL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MATERIAL_X86_SIMD 0
+#endif
+
+
+namespace Material
+{
+namespace ShadowKernels
+{
+
+namespace
+{
+
+// The box size is applied as a fixed-point reciprocal. (window * mul) >> 24
+// equals window / boxSize rounded down for every window a box of up to 256
+// pixels can produce, and the product stays within 32 bits for larger boxes.
+const int RECIPROCAL_SHIFT = 24;
+
+inline quint32 reciprocal(int boxSize)
+{
+    return ((1u << RECIPROCAL_SHIFT) + boxSize - 1) / boxSize;
+}
+
+// Rows are blurred in blocks of BLOCK_ROWS. Each block is first transposed
+// into a scratch buffer in TILE_SIZE square tiles, so that both the reads
+// and the writes of the transpose stay within a few cache lines. The
+// scratch buffer holds pixel x of every row of the block side by side,
+// which lets the kernels blur all rows of the block at once with
+// contiguous loads, and write pixel x of the block as one whole cache
+// line of the transposed destination.
+const int TILE_SIZE = 16;
+
+void transposeBlock(const uchar *src, int srcStride, int width, int rows, uchar *block)
+{
+    for (int x0 = 0; x0 < width; x0 += TILE_SIZE) {
+        const int x1 = std::min(x0 + TILE_SIZE, width);
+        for (int row = 0; row < rows; ++row) {
+            const uchar *in = src + row * srcStride;
+            for (int x = x0; x < x1; ++x) {
+                block[x * BLOCK_ROWS + row] = in[x];
+            }
+        }
+    }
+}
+
+// The window of pixel x covers [x - radius, x + radius], pixels outside of
+// the row are transparent. Every kernel walks the row in four spans:
+// leading edge only, both edges, neither edge (row narrower than the box)
+// and trailing edge only.
+struct Spans
+{
+    Spans(int width, int radius)
+        : addEnd(std::max(0, width - radius))
+        , subBegin(std::min(radius, width)) {}
+
+    int addEnd;   // The leading edge x + radius is inside of the row.
+    int subBegin; // The trailing edge x - radius is inside of the row.
+};
+
+// Blurs the BLOCK_ROWS lanes of a transposed block and stores the first
+// `rows` lanes of pixel x at dst + x * dstStride.
+typedef void (*BlurBlockFunc)(const uchar *block, int width,
+                              uchar *dst, int dstStride, int rows,
+                              int radius, quint32 mul);
+
+void blurBlockScalar(const uchar *block, int width,
+                     uchar *dst, int dstStride, int rows,
+                     int radius, quint32 mul)
+{
+    const Spans spans(width, radius);
+    quint32 window[BLOCK_ROWS] = {};
+    uchar line[BLOCK_ROWS];
+
+    auto add = [&](int x) {
+        const uchar *in = block + x * BLOCK_ROWS;
+        for (int i = 0; i < BLOCK_ROWS; ++i) {
+            window[i] += in[i];
+        }
+    };
+    auto sub = [&](int x) {
+        const uchar *in = block + x * BLOCK_ROWS;
+        for (int i = 0; i < BLOCK_ROWS; ++i) {
+            window[i] -= in[i];
+        }
+    };
+    auto store = [&](int x) {
+        for (int i = 0; i < BLOCK_ROWS; ++i) {
+            line[i] = static_cast<uchar>((window[i] * mul) >> RECIPROCAL_SHIFT);
+        }
+        std::memcpy(dst + x * dstStride, line, rows);
+    };
+
+    for (int x = 0; x < spans.subBegin; ++x) {
+        add(x);
+    }
+
+    int x = 0;
+    for (; x < std::min(spans.addEnd, spans.subBegin); ++x) {
+        add(x + radius);
+        store(x);
+    }
+    for (; x < spans.addEnd; ++x) {
+        add(x + radius);
+        store(x);
+        sub(x - radius);
+    }
+    for (; x < spans.subBegin; ++x) {
+        store(x);
+    }
+    for (; x < width; ++x) {
+        store(x);
+        sub(x - radius);
+    }
+}
+
+// x / 255 rounded to nearest for x up to 255 * 255. The intermediate
+// values stay within 16 bits, so the SIMD kernels use the same formula.
+inline quint32 div255(quint32 x)
+{
+    const quint32 t = x + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+typedef void (*TintFunc)(const uchar *shape, const uchar *contrast, quint32 *dst,
+                         int begin, int end, int shapeOpacity, int contrastOpacity,
+                         quint32 rgb);
+
+void tintScalar(const uchar *shape, const uchar *contrast, quint32 *dst,
+                int begin, int end, int shapeOpacity, int contrastOpacity,
+                quint32 rgb)
+{
+    const quint32 r = (rgb >> 16) & 0xff;
+    const quint32 g = (rgb >> 8) & 0xff;
+    const quint32 b = rgb & 0xff;
+
+    for (int i = begin; i < end; ++i) {
+        const quint32 a1 = (shape[i] * shapeOpacity + 128) >> 8;
+        const quint32 a2 = (contrast[i] * contrastOpacity + 128) >> 8;
+        const quint32 a = a1 + div255(a2 * (255 - a1));
+        dst[i] = (a << 24) | (div255(r * a) << 16) | (div255(g * a) << 8) | div255(b * a);
+    }
+}
+
+#if MATERIAL_X86_SIMD
+
+// The SIMD kernels keep one 32-bit window per lane of the block in vector
+// variables, widening 16 (SSE2) or 8 (AVX2) bytes per load.
+
+const int SSE2_VECTORS = BLOCK_ROWS / 4;
+
+MATERIAL_TARGET_SSE2
+inline void addSse2(__m128i *window, const uchar *in)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < BLOCK_ROWS; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        __m128i *w = window + i / 4;
+        w[0] = _mm_add_epi32(w[0], _mm_unpacklo_epi16(lo, zero));
+        w[1] = _mm_add_epi32(w[1], _mm_unpackhi_epi16(lo, zero));
+        w[2] = _mm_add_epi32(w[2], _mm_unpacklo_epi16(hi, zero));
+        w[3] = _mm_add_epi32(w[3], _mm_unpackhi_epi16(hi, zero));
+    }
+}
+
+MATERIAL_TARGET_SSE2
+inline void subSse2(__m128i *window, const uchar *in)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < BLOCK_ROWS; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        __m128i *w = window + i / 4;
+        w[0] = _mm_sub_epi32(w[0], _mm_unpacklo_epi16(lo, zero));
+        w[1] = _mm_sub_epi32(w[1], _mm_unpackhi_epi16(lo, zero));
+        w[2] = _mm_sub_epi32(w[2], _mm_unpacklo_epi16(hi, zero));
+        w[3] = _mm_sub_epi32(w[3], _mm_unpackhi_epi16(hi, zero));
+    }
+}
+
+MATERIAL_TARGET_SSE2
+inline __m128i scaleSse2(__m128i window, __m128i mul)
+{
+    // SSE2 has no 32-bit mullo, so multiply the even and the odd lanes
+    // separately into 64-bit products. The products fit into 32 bits.
+    const __m128i even = _mm_srli_epi64(_mm_mul_epu32(window, mul), RECIPROCAL_SHIFT);
+    const __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(window, 32), mul), RECIPROCAL_SHIFT);
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+MATERIAL_TARGET_SSE2
+inline void storeSse2(const __m128i *window, __m128i mul, uchar *line)
+{
+    for (int i = 0; i < BLOCK_ROWS; i += 16) {
+        const __m128i *w = window + i / 4;
+        const __m128i lo = _mm_packs_epi32(scaleSse2(w[0], mul), scaleSse2(w[1], mul));
+        const __m128i hi = _mm_packs_epi32(scaleSse2(w[2], mul), scaleSse2(w[3], mul));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + i), _mm_packus_epi16(lo, hi));
+    }
+}
+
+MATERIAL_TARGET_SSE2
+void blurBlockSse2(const uchar *block, int width,
+                   uchar *dst, int dstStride, int rows,
+                   int radius, quint32 mul)
+{
+    const Spans spans(width, radius);
+    const __m128i mulv = _mm_set1_epi32(static_cast<int>(mul));
+    __m128i window[SSE2_VECTORS];
+    for (__m128i &w : window) {
+        w = _mm_setzero_si128();
+    }
+    alignas(16) uchar line[BLOCK_ROWS];
+
+    for (int x = 0; x < spans.subBegin; ++x) {
+        addSse2(window, block + x * BLOCK_ROWS);
+    }
+
+    int x = 0;
+    for (; x < std::min(spans.addEnd, spans.subBegin); ++x) {
+        addSse2(window, block + (x + radius) * BLOCK_ROWS);
+        storeSse2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+    }
+    for (; x < spans.addEnd; ++x) {
+        addSse2(window, block + (x + radius) * BLOCK_ROWS);
+        storeSse2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+        subSse2(window, block + (x - radius) * BLOCK_ROWS);
+    }
+    for (; x < spans.subBegin; ++x) {
+        storeSse2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+    }
+    for (; x < width; ++x) {
+        storeSse2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+        subSse2(window, block + (x - radius) * BLOCK_ROWS);
+    }
+}
+
+const int AVX2_VECTORS = BLOCK_ROWS / 8;
+
+MATERIAL_TARGET_AVX2
+inline void addAvx2(__m256i *window, const uchar *in)
+{
+    for (int i = 0; i < AVX2_VECTORS; ++i) {
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i * 8));
+        window[i] = _mm256_add_epi32(window[i], _mm256_cvtepu8_epi32(bytes));
+    }
+}
+
+MATERIAL_TARGET_AVX2
+inline void subAvx2(__m256i *window, const uchar *in)
+{
+    for (int i = 0; i < AVX2_VECTORS; ++i) {
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i * 8));
+        window[i] = _mm256_sub_epi32(window[i], _mm256_cvtepu8_epi32(bytes));
+    }
+}
+
+MATERIAL_TARGET_AVX2
+inline void storeAvx2(const __m256i *window, __m256i mul, uchar *line)
+{
+    // The packs work within 128-bit lanes, so the dwords of the result
+    // come out as a0 b0 c0 d0 a1 b1 c1 d1 and need one permute.
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for (int i = 0; i < AVX2_VECTORS; i += 4) {
+        const __m256i a = _mm256_srli_epi32(_mm256_mullo_epi32(window[i], mul), RECIPROCAL_SHIFT);
+        const __m256i b = _mm256_srli_epi32(_mm256_mullo_epi32(window[i + 1], mul), RECIPROCAL_SHIFT);
+        const __m256i c = _mm256_srli_epi32(_mm256_mullo_epi32(window[i + 2], mul), RECIPROCAL_SHIFT);
+        const __m256i d = _mm256_srli_epi32(_mm256_mullo_epi32(window[i + 3], mul), RECIPROCAL_SHIFT);
+        const __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(line + i * 8), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+}
+
+MATERIAL_TARGET_AVX2
+void blurBlockAvx2(const uchar *block, int width,
+                   uchar *dst, int dstStride, int rows,
+                   int radius, quint32 mul)
+{
+    const Spans spans(width, radius);
+    const __m256i mulv = _mm256_set1_epi32(static_cast<int>(mul));
+    __m256i window[AVX2_VECTORS];
+    for (__m256i &w : window) {
+        w = _mm256_setzero_si256();
+    }
+    alignas(32) uchar line[BLOCK_ROWS];
+
+    for (int x = 0; x < spans.subBegin; ++x) {
+        addAvx2(window, block + x * BLOCK_ROWS);
+    }
+
+    int x = 0;
+    for (; x < std::min(spans.addEnd, spans.subBegin); ++x) {
+        addAvx2(window, block + (x + radius) * BLOCK_ROWS);
+        storeAvx2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+    }
+    for (; x < spans.addEnd; ++x) {
+        addAvx2(window, block + (x + radius) * BLOCK_ROWS);
+        storeAvx2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+        subAvx2(window, block + (x - radius) * BLOCK_ROWS);
+    }
+    for (; x < spans.subBegin; ++x) {
+        storeAvx2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+    }
+    for (; x < width; ++x) {
+        storeAvx2(window, mulv, line);
+        std::memcpy(dst + x * dstStride, line, rows);
+        subAvx2(window, block + (x - radius) * BLOCK_ROWS);
+    }
+}
+
+// The tint kernels work on 16-bit lanes, 8 (SSE2) or 16 (AVX2) pixels at
+// a time, and leave the remainder to tintScalar.
+
+MATERIAL_TARGET_SSE2
+inline __m128i div255Sse2(__m128i x)
+{
+    const __m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+MATERIAL_TARGET_SSE2
+void tintSse2(const uchar *shape, const uchar *contrast, quint32 *dst,
+              int begin, int end, int shapeOpacity, int contrastOpacity,
+              quint32 rgb)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i opaque = _mm_set1_epi16(255);
+    const __m128i opacity1 = _mm_set1_epi16(static_cast<short>(shapeOpacity));
+    const __m128i opacity2 = _mm_set1_epi16(static_cast<short>(contrastOpacity));
+    const __m128i r = _mm_set1_epi16(static_cast<short>((rgb >> 16) & 0xff));
+    const __m128i g = _mm_set1_epi16(static_cast<short>((rgb >> 8) & 0xff));
+    const __m128i b = _mm_set1_epi16(static_cast<short>(rgb & 0xff));
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const __m128i m1 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(shape + i)), zero);
+        const __m128i m2 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(contrast + i)), zero);
+        const __m128i a1 = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(m1, opacity1), half), 8);
+        const __m128i a2 = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(m2, opacity2), half), 8);
+        const __m128i a = _mm_add_epi16(a1, div255Sse2(_mm_mullo_epi16(a2, _mm_sub_epi16(opaque, a1))));
+
+        const __m128i bg = _mm_or_si128(div255Sse2(_mm_mullo_epi16(b, a)),
+                                        _mm_slli_epi16(div255Sse2(_mm_mullo_epi16(g, a)), 8));
+        const __m128i ra = _mm_or_si128(div255Sse2(_mm_mullo_epi16(r, a)), _mm_slli_epi16(a, 8));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    tintScalar(shape, contrast, dst, i, end, shapeOpacity, contrastOpacity, rgb);
+}
+
+MATERIAL_TARGET_AVX2
+inline __m256i div255Avx2(__m256i x)
+{
+    const __m256i t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+MATERIAL_TARGET_AVX2
+void tintAvx2(const uchar *shape, const uchar *contrast, quint32 *dst,
+              int begin, int end, int shapeOpacity, int contrastOpacity,
+              quint32 rgb)
+{
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i opaque = _mm256_set1_epi16(255);
+    const __m256i opacity1 = _mm256_set1_epi16(static_cast<short>(shapeOpacity));
+    const __m256i opacity2 = _mm256_set1_epi16(static_cast<short>(contrastOpacity));
+    const __m256i r = _mm256_set1_epi16(static_cast<short>((rgb >> 16) & 0xff));
+    const __m256i g = _mm256_set1_epi16(static_cast<short>((rgb >> 8) & 0xff));
+    const __m256i b = _mm256_set1_epi16(static_cast<short>(rgb & 0xff));
+
+    int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        const __m256i m1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(shape + i)));
+        const __m256i m2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(contrast + i)));
+        const __m256i a1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(m1, opacity1), half), 8);
+        const __m256i a2 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(m2, opacity2), half), 8);
+        const __m256i a = _mm256_add_epi16(a1, div255Avx2(_mm256_mullo_epi16(a2, _mm256_sub_epi16(opaque, a1))));
+
+        const __m256i bg = _mm256_or_si256(div255Avx2(_mm256_mullo_epi16(b, a)),
+                                           _mm256_slli_epi16(div255Avx2(_mm256_mullo_epi16(g, a)), 8));
+        const __m256i ra = _mm256_or_si256(div255Avx2(_mm256_mullo_epi16(r, a)), _mm256_slli_epi16(a, 8));
+
+        // The unpacks work within 128-bit lanes, lo holds pixels 0-3 and
+        // 8-11, hi holds pixels 4-7 and 12-15.
+        const __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+        const __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    tintScalar(shape, contrast, dst, i, end, shapeOpacity, contrastOpacity, rgb);
+}
+
+#endif // MATERIAL_X86_SIMD
+
+Implementation detectImplementation()
+{
+#if MATERIAL_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return Implementation::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Implementation::SSE2;
+    }
+#endif
+    return Implementation::Scalar;
+}
+
+} // anonymous namespace
+
+Implementation implementation()
+{
+    static const Implementation impl = detectImplementation();
+    return impl;
+}
+
+const char *implementationName(Implementation impl)
+{
+    switch (impl) {
+    case Implementation::SSE2:
+        return "sse2";
+    case Implementation::AVX2:
+        return "avx2";
+    default:
+    case Implementation::Scalar:
+        return "scalar";
+    }
+}
+
+void boxBlurTransposed(const uchar *src, int srcStride,
+                       uchar *dst, int dstStride,
+                       int width, int height, int boxSize)
+{
+    BlurBlockFunc blurBlock = blurBlockScalar;
+#if MATERIAL_X86_SIMD
+    switch (implementation()) {
+    case Implementation::AVX2:
+        blurBlock = blurBlockAvx2;
+        break;
+    case Implementation::SSE2:
+        blurBlock = blurBlockSse2;
+        break;
+    default:
+        break;
+    }
+#endif
+
+    const int radius = (boxSize - 1) / 2;
+    const quint32 mul = reciprocal(boxSize);
+
+    // Lanes past the last row of a partial block are blurred but never
+    // stored, they only need to be initialized.
+    std::vector<uchar> block(static_cast<size_t>(width) * BLOCK_ROWS, 0);
+
+    for (int y = 0; y < height; y += BLOCK_ROWS) {
+        const int rows = std::min(BLOCK_ROWS, height - y);
+        transposeBlock(src + y * srcStride, srcStride, width, rows, block.data());
+        blurBlock(block.data(), width, dst + y, dstStride, rows, radius, mul);
+    }
+}
+
+void tint(const uchar *shape, const uchar *contrast, quint32 *dst, int count,
+          int shapeOpacity, int contrastOpacity, quint32 rgb)
+{
+    TintFunc tintPixels = tintScalar;
+#if MATERIAL_X86_SIMD
+    switch (implementation()) {
+    case Implementation::AVX2:
+        tintPixels = tintAvx2;
+        break;
+    case Implementation::SSE2:
+        tintPixels = tintSse2;
+        break;
+    default:
+        break;
+    }
+#endif
+
+    tintPixels(shape, contrast, dst, 0, count, shapeOpacity, contrastOpacity, rgb);
+}
+
+} // namespace ShadowKernels
+} // namespace Material
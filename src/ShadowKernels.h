@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Qt
+#include <QtGlobal>
+
+namespace Material
+{
+namespace ShadowKernels
+{
+
+// Rows that the blur kernels process together. Splitting the rows of an
+// image at multiples of it keeps every block but the last one full.
+const int BLOCK_ROWS = 64;
+
+enum class Implementation {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+// The best implementation supported by the running CPU.
+// It is detected once and then cached.
+Implementation implementation();
+const char *implementationName(Implementation impl);
+
+// Box blurs every row of an 8-bit alpha plane and writes the result
+// transposed into dst, so that running it twice blurs in both directions.
+// Strides are in bytes.
+void boxBlurTransposed(const uchar *src, int srcStride,
+                       uchar *dst, int dstStride,
+                       int width, int height, int boxSize);
+
+// Composites `count` pixels of the shape and contrast alpha masks with
+// source over, after scaling them by shapeOpacity and contrastOpacity
+// (0 - 256), and writes them as the color rgb in premultiplied ARGB32.
+void tint(const uchar *shape, const uchar *contrast, quint32 *dst, int count,
+          int shapeOpacity, int contrastOpacity, quint32 rgb);
+
+} // namespace ShadowKernels
+} // namespace Material
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// own
+#include "BenchBridge.h"
+
+// KDecoration
+#include <KDecoration2/DecorationSettings>
+
+// Qt
+#include <QIcon>
+
+namespace Material
+{
+
+BenchClient::BenchClient(KDecoration2::DecoratedClient *client, KDecoration2::Decoration *decoration)
+    : ApplicationMenuEnabledDecoratedClientPrivate(client, decoration)
+    , m_client(client)
+{
+}
+
+void BenchClient::setCaption(const QString &caption)
+{
+    m_caption = caption;
+    emit m_client->captionChanged(caption);
+}
+
+void BenchClient::setActive(bool active)
+{
+    m_active = active;
+    emit m_client->activeChanged(active);
+}
+
+void BenchClient::setSize(const QSize &size)
+{
+    m_size = size;
+    emit m_client->widthChanged(size.width());
+    emit m_client->heightChanged(size.height());
+    emit m_client->sizeChanged(size);
+}
+
+void BenchClient::setHasApplicationMenu(bool hasApplicationMenu)
+{
+    m_hasApplicationMenu = hasApplicationMenu;
+    emit m_client->hasApplicationMenuChanged(hasApplicationMenu);
+}
+
+bool BenchClient::isActive() const { return m_active; }
+QString BenchClient::caption() const { return m_caption; }
+int BenchClient::desktop() const { return 1; }
+bool BenchClient::isOnAllDesktops() const { return false; }
+bool BenchClient::isShaded() const { return false; }
+QIcon BenchClient::icon() const { return QIcon(); }
+bool BenchClient::isMaximized() const { return false; }
+bool BenchClient::isMaximizedHorizontally() const { return false; }
+bool BenchClient::isMaximizedVertically() const { return false; }
+bool BenchClient::isKeepAbove() const { return false; }
+bool BenchClient::isKeepBelow() const { return false; }
+
+bool BenchClient::isCloseable() const { return true; }
+bool BenchClient::isMaximizeable() const { return true; }
+bool BenchClient::isMinimizeable() const { return true; }
+bool BenchClient::providesContextHelp() const { return false; }
+bool BenchClient::isModal() const { return false; }
+bool BenchClient::isShadeable() const { return true; }
+bool BenchClient::isMoveable() const { return true; }
+bool BenchClient::isResizeable() const { return true; }
+
+// No window, so the app menu model never finds a menu, the benchmark
+// fills the menu buttons itself.
+WId BenchClient::windowId() const { return 0; }
+WId BenchClient::decorationId() const { return 0; }
+
+int BenchClient::width() const { return m_size.width(); }
+int BenchClient::height() const { return m_size.height(); }
+QSize BenchClient::size() const { return m_size; }
+QPalette BenchClient::palette() const { return m_palette; }
+Qt::Edges BenchClient::adjacentScreenEdges() const { return Qt::Edges(); }
+
+void BenchClient::requestShowToolTip(const QString &text) { Q_UNUSED(text) }
+void BenchClient::requestHideToolTip() {}
+void BenchClient::requestClose() {}
+void BenchClient::requestToggleMaximization(Qt::MouseButtons buttons) { Q_UNUSED(buttons) }
+void BenchClient::requestMinimize() {}
+void BenchClient::requestShowWindowMenu(const QRect &rect) { Q_UNUSED(rect) }
+void BenchClient::requestShowApplicationMenu(const QRect &rect, int actionId) { Q_UNUSED(rect) Q_UNUSED(actionId) }
+void BenchClient::requestToggleOnAllDesktops() {}
+void BenchClient::requestContextHelp() {}
+void BenchClient::requestToggleShade() {}
+void BenchClient::requestToggleKeepAbove() {}
+void BenchClient::requestToggleKeepBelow() {}
+
+bool BenchClient::hasApplicationMenu() const { return m_hasApplicationMenu; }
+bool BenchClient::isApplicationMenuActive() const { return false; }
+void BenchClient::showApplicationMenu(int actionId) { Q_UNUSED(actionId) }
+
+
+BenchSettings::BenchSettings(KDecoration2::DecorationSettings *parent)
+    : DecorationSettingsPrivate(parent)
+{
+}
+
+bool BenchSettings::isOnAllDesktopsAvailable() const { return true; }
+bool BenchSettings::isAlphaChannelSupported() const { return true; }
+bool BenchSettings::isCloseOnDoubleClickOnMenu() const { return false; }
+
+QVector<KDecoration2::DecorationButtonType> BenchSettings::decorationButtonsLeft() const
+{
+    return {
+        KDecoration2::DecorationButtonType::Menu,
+        KDecoration2::DecorationButtonType::ApplicationMenu,
+        KDecoration2::DecorationButtonType::OnAllDesktops,
+    };
+}
+
+QVector<KDecoration2::DecorationButtonType> BenchSettings::decorationButtonsRight() const
+{
+    return {
+        KDecoration2::DecorationButtonType::ContextHelp,
+        KDecoration2::DecorationButtonType::Minimize,
+        KDecoration2::DecorationButtonType::Maximize,
+        KDecoration2::DecorationButtonType::Close,
+    };
+}
+
+KDecoration2::BorderSize BenchSettings::borderSize() const
+{
+    return KDecoration2::BorderSize::Normal;
+}
+
+
+std::unique_ptr<KDecoration2::DecoratedClientPrivate> BenchBridge::createClient(
+    KDecoration2::DecoratedClient *client, KDecoration2::Decoration *decoration)
+{
+    auto benchClient = std::make_unique<BenchClient>(client, decoration);
+    m_client = benchClient.get();
+    return benchClient;
+}
+
+std::unique_ptr<KDecoration2::DecorationSettingsPrivate> BenchBridge::settings(
+    KDecoration2::DecorationSettings *parent)
+{
+    return std::make_unique<BenchSettings>(parent);
+}
+
+void BenchBridge::update(KDecoration2::Decoration *decoration, const QRect &geometry)
+{
+    Q_UNUSED(decoration)
+    ++m_updates;
+    m_damage += geometry;
+}
+
+BenchClient *BenchBridge::client() const
+{
+    return m_client;
+}
+
+int BenchBridge::updates() const
+{
+    return m_updates;
+}
+
+QRegion BenchBridge::damage() const
+{
+    return m_damage;
+}
+
+void BenchBridge::resetUpdates()
+{
+    m_updates = 0;
+    m_damage = QRegion();
+}
+
+} // namespace Material
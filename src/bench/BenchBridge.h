@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// KDecoration
+#include <KDecoration2/DecoratedClient>
+#include <KDecoration2/Decoration>
+#include <KDecoration2/Private/DecoratedClientPrivate>
+#include <KDecoration2/Private/DecorationBridge>
+#include <KDecoration2/Private/DecorationSettingsPrivate>
+
+// Qt
+#include <QPalette>
+#include <QRect>
+#include <QRegion>
+#include <QVector>
+
+// std
+#include <memory>
+
+namespace Material
+{
+
+// Stand-ins for what KWin provides to a decoration, enough to construct,
+// configure and paint one without a compositor. Built against the
+// private KDecoration2 interfaces, like the bridges of the KCM preview
+// and the GTK button renderer.
+
+class BenchClient : public KDecoration2::ApplicationMenuEnabledDecoratedClientPrivate
+{
+public:
+    BenchClient(KDecoration2::DecoratedClient *client, KDecoration2::Decoration *decoration);
+
+    // Change the window like KWin would, including the signals.
+    void setCaption(const QString &caption);
+    void setActive(bool active);
+    void setSize(const QSize &size);
+    void setHasApplicationMenu(bool hasApplicationMenu);
+
+    bool isActive() const override;
+    QString caption() const override;
+    int desktop() const override;
+    bool isOnAllDesktops() const override;
+    bool isShaded() const override;
+    QIcon icon() const override;
+    bool isMaximized() const override;
+    bool isMaximizedHorizontally() const override;
+    bool isMaximizedVertically() const override;
+    bool isKeepAbove() const override;
+    bool isKeepBelow() const override;
+
+    bool isCloseable() const override;
+    bool isMaximizeable() const override;
+    bool isMinimizeable() const override;
+    bool providesContextHelp() const override;
+    bool isModal() const override;
+    bool isShadeable() const override;
+    bool isMoveable() const override;
+    bool isResizeable() const override;
+
+    WId windowId() const override;
+    WId decorationId() const override;
+
+    int width() const override;
+    int height() const override;
+    QSize size() const override;
+    QPalette palette() const override;
+    Qt::Edges adjacentScreenEdges() const override;
+
+    void requestShowToolTip(const QString &text) override;
+    void requestHideToolTip() override;
+    void requestClose() override;
+    void requestToggleMaximization(Qt::MouseButtons buttons) override;
+    void requestMinimize() override;
+    void requestShowWindowMenu(const QRect &rect) override;
+    void requestShowApplicationMenu(const QRect &rect, int actionId) override;
+    void requestToggleOnAllDesktops() override;
+    void requestContextHelp() override;
+    void requestToggleShade() override;
+    void requestToggleKeepAbove() override;
+    void requestToggleKeepBelow() override;
+
+    bool hasApplicationMenu() const override;
+    bool isApplicationMenuActive() const override;
+    void showApplicationMenu(int actionId) override;
+
+private:
+    KDecoration2::DecoratedClient *m_client;
+    QString m_caption = QStringLiteral("decobench");
+    bool m_active = true;
+    bool m_hasApplicationMenu = false;
+    QSize m_size = QSize(1280, 720);
+    QPalette m_palette;
+};
+
+class BenchSettings : public KDecoration2::DecorationSettingsPrivate
+{
+public:
+    explicit BenchSettings(KDecoration2::DecorationSettings *parent);
+
+    bool isOnAllDesktopsAvailable() const override;
+    bool isAlphaChannelSupported() const override;
+    bool isCloseOnDoubleClickOnMenu() const override;
+    QVector<KDecoration2::DecorationButtonType> decorationButtonsLeft() const override;
+    QVector<KDecoration2::DecorationButtonType> decorationButtonsRight() const override;
+    KDecoration2::BorderSize borderSize() const override;
+};
+
+class BenchBridge : public KDecoration2::DecorationBridge
+{
+    Q_OBJECT
+
+public:
+    std::unique_ptr<KDecoration2::DecoratedClientPrivate> createClient(
+        KDecoration2::DecoratedClient *client, KDecoration2::Decoration *decoration) override;
+    std::unique_ptr<KDecoration2::DecorationSettingsPrivate> settings(
+        KDecoration2::DecorationSettings *parent) override;
+    void update(KDecoration2::Decoration *decoration, const QRect &geometry) override;
+
+    // The client of the most recently created decoration.
+    BenchClient *client() const;
+
+    // Repaints the decorations asked KWin for.
+    int updates() const;
+    QRegion damage() const;
+    void resetUpdates();
+
+private:
+    BenchClient *m_client = nullptr;
+    int m_updates = 0;
+    QRegion m_damage;
+};
+
+} // namespace Material
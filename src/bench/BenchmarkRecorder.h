@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Qt
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+#include <QtTest>
+
+// std
+#include <algorithm>
+
+namespace Material
+{
+
+// Times the benchmarks of a QTest object and collects the results as
+// JSON, which QTest itself can only do from Qt 6 on.
+class BenchmarkRecorder
+{
+public:
+    // Every measurement runs at least MIN_SAMPLES times and then until its
+    // time budget is used up.
+    static const int MIN_SAMPLES = 5;
+    static const int MAX_SAMPLES = 1000;
+    static const qint64 TIME_BUDGET_MS = 500;
+
+    // Returns the result, so that callers can add their own fields to it.
+    // The reference is valid until the next measurement.
+    template<typename Function>
+    QJsonObject &measure(const QString &name, const QJsonObject &params, Function function)
+    {
+        // Warm up caches and thread pools.
+        function();
+
+        QVector<qint64> samples;
+        QElapsedTimer budget;
+        budget.start();
+        while (samples.size() < MIN_SAMPLES
+            || (samples.size() < MAX_SAMPLES && budget.elapsed() < TIME_BUDGET_MS)
+        ) {
+            QElapsedTimer timer;
+            timer.start();
+            function();
+            samples.append(timer.nsecsElapsed());
+        }
+
+        std::sort(samples.begin(), samples.end());
+        qint64 total = 0;
+        for (const qint64 sample : qAsConst(samples)) {
+            total += sample;
+        }
+
+        QJsonObject result;
+        result[QStringLiteral("name")] = name;
+        result[QStringLiteral("case")] = QString::fromLatin1(QTest::currentDataTag());
+        result[QStringLiteral("params")] = params;
+        result[QStringLiteral("samples")] = samples.size();
+        result[QStringLiteral("median_ns")] = double(samples.at(samples.size() / 2));
+        result[QStringLiteral("min_ns")] = double(samples.first());
+        result[QStringLiteral("mean_ns")] = double(total / samples.size());
+        m_results.append(result);
+
+        qInfo("%s %s: median %.3f ms over %d runs", qPrintable(name), QTest::currentDataTag(),
+              samples.at(samples.size() / 2) / 1e6, int(samples.size()));
+        return m_results.last();
+    }
+
+    // Writes root with the results added to it.
+    bool write(const QString &path, QJsonObject root) const
+    {
+        QJsonArray results;
+        for (const QJsonObject &result : m_results) {
+            results.append(result);
+        }
+        root[QStringLiteral("qtVersion")] = QString::fromLatin1(qVersion());
+        root[QStringLiteral("results")] = results;
+
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly)
+            && file.write(QJsonDocument(root).toJson()) >= 0;
+    }
+
+    // Removes "-json <path>" from the arguments before they are passed on
+    // to QTest, which would reject it.
+    static QString takeJsonPath(QStringList &args, const QString &defaultPath)
+    {
+        const int index = args.indexOf(QStringLiteral("-json"));
+        if (index <= 0 || index + 1 >= args.size()) {
+            return defaultPath;
+        }
+        const QString path = args.at(index + 1);
+        args.erase(args.begin() + index, args.begin() + index + 2);
+        return path;
+    }
+
+private:
+    QVector<QJsonObject> m_results;
+};
+
+} // namespace Material
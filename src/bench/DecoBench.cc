@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Paints Material::Decoration offscreen through BenchBridge, without KWin
+// or a compositor, across the settings that change the paint path.
+//
+//   decobench [-json results.json] [QTest options]
+//
+// Timings are written to decobench.json unless -json is given. Besides
+// the time, every measurement records the operator new calls of a single
+// run, and the reconfigure case the repaints that reached the bridge.
+
+// own
+#include "AppMenuButtonGroup.h"
+#include "BenchBridge.h"
+#include "BenchmarkRecorder.h"
+#include "Decoration.h"
+#include "InternalSettings.h"
+#include "Material.h"
+#include "MenuOverflowButton.h"
+#include "TextButton.h"
+
+// KDecoration
+#include <KDecoration2/DecorationButton>
+#include <KDecoration2/DecorationSettings>
+
+// KF
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+// Qt
+#include <QApplication>
+#include <QImage>
+#include <QMenu>
+#include <QPainter>
+#include <QStandardPaths>
+#include <QtTest>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace
+{
+std::atomic<qint64> s_allocations{0};
+} // anonymous namespace
+
+// Counts the allocations made through operator new, QImage pixel data and
+// other malloc calls are not included.
+void *operator new(std::size_t size)
+{
+    ++s_allocations;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+using namespace Material;
+
+namespace
+{
+
+struct Scenario
+{
+    int titleAlignment = InternalSettings::AlignCenterFullWidth;
+    int buttonSize = InternalSettings::ButtonDefault;
+    double activeOpacity = 0.75;
+    double inactiveOpacity = 0.85;
+    bool appMenu = false;
+    bool menuAlwaysShow = true;
+    bool renderTitleBarInBackground = false;
+    QSize size = QSize(1280, 720);
+};
+
+// One decoration with its own bridge, like a window in KWin.
+struct BenchDecoration
+{
+    std::unique_ptr<BenchBridge> bridge;
+    std::unique_ptr<QMenu> appMenu;
+    std::unique_ptr<Decoration> decoration;
+    QSharedPointer<KDecoration2::DecorationSettings> settings;
+};
+
+void writeSettings(const Scenario &scenario)
+{
+    KSharedConfig::Ptr config = KSharedConfig::openConfig(s_configFilename);
+    KConfigGroup group(config, "Windeco");
+    group.writeEntry("TitleAlignment", scenario.titleAlignment);
+    group.writeEntry("ButtonSize", scenario.buttonSize);
+    group.writeEntry("ActiveOpacity", scenario.activeOpacity);
+    group.writeEntry("InactiveOpacity", scenario.inactiveOpacity);
+    group.writeEntry("MenuAlwaysShow", scenario.menuAlwaysShow);
+    group.writeEntry("RenderTitleBarInBackground", scenario.renderTitleBarInBackground);
+    config->sync();
+}
+
+// The app menu model needs the application's menu over DBus, so the menu
+// buttons are added the way AppMenuButtonGroup::updateAppMenuModel does
+// from a menu bar of fixed top-level entries.
+std::unique_ptr<QMenu> populateAppMenu(Decoration *decoration, BenchClient *client)
+{
+    auto menuBar = std::make_unique<QMenu>();
+    const char *titles[] = { "File", "Edit", "View", "Go", "Bookmarks", "Tools", "Settings", "Help" };
+    for (const char *title : titles) {
+        menuBar->addMenu(QLatin1String(title))->addAction(QStringLiteral("decobench"));
+    }
+
+    client->setHasApplicationMenu(true);
+    auto *group = decoration->findChild<AppMenuButtonGroup *>();
+    const auto actions = menuBar->actions();
+    for (int row = 0; row < actions.size(); row++) {
+        auto *button = new TextButton(decoration, row, group);
+        button->setText(actions[row]->text());
+        button->setAction(actions[row]);
+        button->setOpacity(group->opacity());
+        group->addButton(QPointer<KDecoration2::DecorationButton>(button));
+    }
+    group->addButton(new MenuOverflowButton(decoration, actions.size(), group));
+    emit group->menuUpdated();
+    return menuBar;
+}
+
+BenchDecoration createDecoration(const Scenario &scenario)
+{
+    writeSettings(scenario);
+
+    BenchDecoration result;
+    result.bridge = std::make_unique<BenchBridge>();
+    const QVariantMap args{
+        { QStringLiteral("bridge"), QVariant::fromValue(static_cast<KDecoration2::DecorationBridge *>(result.bridge.get())) },
+    };
+    result.decoration = std::make_unique<Decoration>(nullptr, QVariantList{ args });
+    result.settings = QSharedPointer<KDecoration2::DecorationSettings>::create(result.bridge.get());
+    result.decoration->setSettings(result.settings);
+    result.decoration->init();
+    result.bridge->client()->setSize(scenario.size);
+    if (scenario.appMenu) {
+        result.appMenu = populateAppMenu(result.decoration.get(), result.bridge->client());
+    }
+
+    // Let queued repaints and shadow jobs settle before anything is timed.
+    QCoreApplication::processEvents();
+    return result;
+}
+
+QJsonObject scenarioParams(const Scenario &scenario)
+{
+    QJsonObject params;
+    params[QStringLiteral("titleAlignment")] = scenario.titleAlignment;
+    params[QStringLiteral("buttonSize")] = scenario.buttonSize;
+    params[QStringLiteral("activeOpacity")] = scenario.activeOpacity;
+    params[QStringLiteral("inactiveOpacity")] = scenario.inactiveOpacity;
+    params[QStringLiteral("appMenu")] = scenario.appMenu;
+    params[QStringLiteral("menuAlwaysShow")] = scenario.menuAlwaysShow;
+    params[QStringLiteral("renderTitleBarInBackground")] = scenario.renderTitleBarInBackground;
+    params[QStringLiteral("width")] = scenario.size.width();
+    params[QStringLiteral("height")] = scenario.size.height();
+    return params;
+}
+
+template<typename Function>
+qint64 countAllocations(Function function)
+{
+    const qint64 before = s_allocations;
+    function();
+    return s_allocations - before;
+}
+
+} // anonymous namespace
+
+Q_DECLARE_METATYPE(Scenario)
+
+class DecoBench : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DecoBench(const QString &jsonPath)
+        : m_jsonPath(jsonPath) {}
+
+private slots:
+    void initTestCase();
+
+    void paint_data();
+    void paint();
+
+    void cleanupTestCase();
+
+private:
+    // Times the function and adds the allocations of one more run.
+    template<typename Function>
+    QJsonObject &measure(const QString &name, const QJsonObject &params, Function function);
+
+    QString m_jsonPath;
+    BenchmarkRecorder m_recorder;
+};
+
+template<typename Function>
+QJsonObject &DecoBench::measure(const QString &name, const QJsonObject &params, Function function)
+{
+    QJsonObject &result = m_recorder.measure(name, params, function);
+    result[QStringLiteral("allocations")] = double(countAllocations(function));
+    return result;
+}
+
+void DecoBench::initTestCase()
+{
+    // Keeps the settings written below out of the user's configuration.
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void DecoBench::paint_data()
+{
+    QTest::addColumn<Scenario>("scenario");
+
+    // Every setting is varied on its own, starting from the defaults.
+    const Scenario defaults;
+    QTest::newRow("default") << defaults;
+
+    const struct {
+        const char *name;
+        int value;
+    } alignments[] = {
+        { "left", InternalSettings::AlignLeft },
+        { "center", InternalSettings::AlignCenter },
+        { "right", InternalSettings::AlignRight },
+        { "hidden", InternalSettings::TitleHidden },
+    };
+    for (const auto &alignment : alignments) {
+        Scenario scenario = defaults;
+        scenario.titleAlignment = alignment.value;
+        QTest::newRow(qPrintable(QStringLiteral("align-%1").arg(QLatin1String(alignment.name)))) << scenario;
+    }
+
+    const struct {
+        const char *name;
+        int value;
+    } buttonSizes[] = {
+        { "tiny", InternalSettings::ButtonTiny },
+        { "small", InternalSettings::ButtonSmall },
+        { "large", InternalSettings::ButtonLarge },
+        { "verylarge", InternalSettings::ButtonVeryLarge },
+    };
+    for (const auto &buttonSize : buttonSizes) {
+        Scenario scenario = defaults;
+        scenario.buttonSize = buttonSize.value;
+        QTest::newRow(qPrintable(QStringLiteral("buttons-%1").arg(QLatin1String(buttonSize.name)))) << scenario;
+    }
+
+    Scenario opaque = defaults;
+    opaque.activeOpacity = 1.0;
+    opaque.inactiveOpacity = 1.0;
+    QTest::newRow("opaque") << opaque;
+
+    // The locally integrated menu, laid out before the caption, and the
+    // same menu hidden until the title bar is hovered.
+    Scenario menu = defaults;
+    menu.appMenu = true;
+    QTest::newRow("menu-on") << menu;
+
+    Scenario menuHidden = menu;
+    menuHidden.menuAlwaysShow = false;
+    QTest::newRow("menu-hidden") << menuHidden;
+
+    // Caption and focus changes only start a job, the previous caption
+    // is painted until it is done.
+    Scenario background = defaults;
+    background.renderTitleBarInBackground = true;
+    QTest::newRow("background") << background;
+
+    // The frame is painted as border strips, so the cost should not grow
+    // with the client.
+    const QSize sizes[] = { QSize(640, 480), QSize(1920, 1080), QSize(3840, 2160) };
+    for (const QSize &size : sizes) {
+        Scenario scenario = defaults;
+        scenario.size = size;
+        QTest::newRow(qPrintable(QStringLiteral("size-%1x%2").arg(size.width()).arg(size.height()))) << scenario;
+    }
+}
+
+void DecoBench::paint()
+{
+    QFETCH(Scenario, scenario);
+
+    BenchDecoration bench = createDecoration(scenario);
+    Decoration *decoration = bench.decoration.get();
+    BenchClient *client = bench.bridge->client();
+    const QJsonObject params = scenarioParams(scenario);
+
+    // Otherwise the menu rows would measure a title bar without a menu.
+    if (scenario.appMenu) {
+        const auto menuButtons = decoration->findChildren<TextButton *>();
+        QVERIFY(std::any_of(menuButtons.cbegin(), menuButtons.cend(),
+            [](const TextButton *button) { return button->isVisible(); }));
+    }
+
+    QImage target(decoration->rect().size(), QImage::Format_ARGB32_Premultiplied);
+    target.fill(Qt::transparent);
+    QVERIFY(!target.isNull());
+
+    auto paintRegion = [&](const QRect &region) {
+        QPainter painter(&target);
+        decoration->paint(&painter, region);
+    };
+
+    // A repaint with nothing changed, like after an unrelated damage.
+    const QRect fullRect = decoration->rect();
+    auto paintFull = [&] { paintRegion(fullRect); };
+    measure(QStringLiteral("paint"), params, paintFull);
+
+    // A terminal or browser updating its title.
+    int captionIndex = 0;
+    auto paintCaption = [&] {
+        client->setCaption(QStringLiteral("decobench - caption %1").arg(++captionIndex));
+        paintRegion(decoration->titleBarRect());
+    };
+    measure(QStringLiteral("captionChange"), params, paintCaption);
+
+    // A hover only damages the button under the pointer.
+    QRect buttonRect = decoration->titleBarRect();
+    const auto buttons = decoration->findChildren<KDecoration2::DecorationButton *>();
+    for (const auto *button : buttons) {
+        if (button->type() == KDecoration2::DecorationButtonType::Close) {
+            buttonRect = button->geometry().toAlignedRect();
+        }
+    }
+    auto paintButton = [&] { paintRegion(buttonRect); };
+    measure(QStringLiteral("buttonRepaint"), params, paintButton);
+
+    // Focus changes swap the shadow and repaint the title bar.
+    bool active = true;
+    auto toggleActive = [&] {
+        active = !active;
+        client->setActive(active);
+        QCoreApplication::processEvents();
+        paintFull();
+    };
+    measure(QStringLiteral("activeChange"), params, toggleActive);
+
+    // What a settings change costs, and how many of its repaint requests
+    // reach KWin.
+    auto reconfigure = [&] {
+        decoration->reconfigure();
+        QCoreApplication::processEvents();
+    };
+    const int coalescedBefore = decoration->coalescedRepaints();
+    bench.bridge->resetUpdates();
+    reconfigure();
+    const int updates = bench.bridge->updates();
+    const int coalesced = decoration->coalescedRepaints() - coalescedBefore;
+
+    QJsonObject &result = measure(QStringLiteral("reconfigure"), params, reconfigure);
+    result[QStringLiteral("bridgeUpdates")] = updates;
+    result[QStringLiteral("coalescedRepaints")] = coalesced;
+}
+
+void DecoBench::cleanupTestCase()
+{
+    QJsonObject root;
+    root[QStringLiteral("benchmark")] = QStringLiteral("decobench");
+    root[QStringLiteral("platform")] = QGuiApplication::platformName();
+    QVERIFY2(m_recorder.write(m_jsonPath, root), qPrintable(m_jsonPath));
+}
+
+int main(int argc, char **argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    DecoBench bench(BenchmarkRecorder::takeJsonPath(args, QStringLiteral("decobench.json")));
+    return QTest::qExec(&bench, args);
+}
+
+#include "DecoBench.moc"
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times the shadow generation for every size preset at common output
+// scales, and checks the faster paths against the reference ones.
+//
+//   shadowbench [-json results.json] [QTest options]
+//
+// Timings are written to shadowbench.json unless -json is given.
+
+// own
+#include "BenchmarkRecorder.h"
+#include "BoxShadowHelper.h"
+#include "InternalSettings.h"
+#include "ShadowCache.h"
+#include "ShadowKernels.h"
+
+// Qt
+#include <QGuiApplication>
+#include <QJsonObject>
+#include <QThread>
+#include <QtTest>
+
+// std
+#include <cstring>
+
+using namespace Material;
+
+namespace
+{
+
+// Largest alpha difference allowed between reduced and full resolution.
+const int MAX_REDUCED_RESOLUTION_ERROR = 8;
+// Largest alpha difference allowed between the analytic and the box blur
+// method. The box blur rounds down after every pass, so it is darker.
+const int MAX_ANALYTIC_ERROR = 8;
+
+struct Preset
+{
+    const char *name;
+    int sizePreset;
+};
+
+const Preset s_presets[] = {
+    { "small", InternalSettings::ShadowSmall },
+    { "medium", InternalSettings::ShadowMedium },
+    { "large", InternalSettings::ShadowLarge },
+    { "verylarge", InternalSettings::ShadowVeryLarge },
+};
+
+const qreal s_devicePixelRatios[] = { 1, 1.25, 1.5, 2, 3 };
+
+// A Format_Alpha8 image like the ones the shadows blur, an opaque box with
+// a transparent margin of the blur radius.
+QImage boxMask(int radius, qreal dpr)
+{
+    const int margin = qRound(radius * dpr);
+    const QSize boxSize = QSize(2 * radius + 1, 2 * radius + 1) * dpr;
+    QImage image(boxSize + 2 * QSize(margin, margin), QImage::Format_Alpha8);
+    image.fill(0);
+    for (int y = margin; y < margin + boxSize.height(); ++y) {
+        std::memset(image.scanLine(y) + margin, 0xff, boxSize.width());
+    }
+    return image;
+}
+
+int maxAlphaDifference(const QImage &a, const QImage &b)
+{
+    int difference = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        const QRgb *lineA = reinterpret_cast<const QRgb *>(a.constScanLine(y));
+        const QRgb *lineB = reinterpret_cast<const QRgb *>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); ++x) {
+            difference = qMax(difference, qAbs(qAlpha(lineA[x]) - qAlpha(lineB[x])));
+        }
+    }
+    return difference;
+}
+
+} // anonymous namespace
+
+class ShadowBench : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ShadowBench(const QString &jsonPath)
+        : m_jsonPath(jsonPath) {}
+
+private slots:
+    void boxSizeTable();
+
+    void computeBoxSizes_data();
+    void computeBoxSizes();
+
+    void boxBlurPass_data();
+    void boxBlurPass();
+
+    void boxBlurAlpha_data();
+    void boxBlurAlpha();
+
+    void shadowTexture_data();
+    void shadowTexture();
+
+    void reducedResolution_data();
+    void reducedResolution();
+
+    void cleanupTestCase();
+
+private:
+    void addPresetRows(bool withMethods);
+
+    QString m_jsonPath;
+    BenchmarkRecorder m_recorder;
+};
+
+void ShadowBench::addPresetRows(bool withMethods)
+{
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+    QTest::addColumn<int>("method");
+
+    const int methods[] = { InternalSettings::ShadowBoxBlur, InternalSettings::ShadowAnalytic };
+    for (const Preset &preset : s_presets) {
+        const int radius = shadowRadius(preset.sizePreset, 0);
+        for (const qreal dpr : s_devicePixelRatios) {
+            for (const int method : methods) {
+                if (!withMethods && method != InternalSettings::ShadowBoxBlur) {
+                    continue;
+                }
+                const char *methodName = method == InternalSettings::ShadowBoxBlur ? "boxblur" : "analytic";
+                const QByteArray tag = withMethods
+                    ? QStringLiteral("%1@%2/%3").arg(QLatin1String(preset.name)).arg(dpr).arg(QLatin1String(methodName)).toLatin1()
+                    : QStringLiteral("%1@%2").arg(QLatin1String(preset.name)).arg(dpr).toLatin1();
+                QTest::newRow(tag.constData()) << radius << dpr << method;
+            }
+        }
+    }
+}
+
+void ShadowBench::boxSizeTable()
+{
+    // The compile-time table has to match the runtime formula everywhere.
+    for (int radius = 0; radius <= BoxShadowHelper::MAX_BLUR_RADIUS; ++radius) {
+        const QVector<int> expected = BoxShadowHelper::computeBoxSizes(radius, BoxShadowHelper::NUM_BOX_BLUR_PASSES);
+        const BoxShadowHelper::BoxSizes &actual = BoxShadowHelper::boxSizes(radius);
+        for (int i = 0; i < BoxShadowHelper::NUM_BOX_BLUR_PASSES; ++i) {
+            QCOMPARE(actual.sizes[i], expected.at(i));
+        }
+    }
+}
+
+void ShadowBench::computeBoxSizes_data()
+{
+    addPresetRows(false);
+}
+
+void ShadowBench::computeBoxSizes()
+{
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const int deviceRadius = qRound(radius * dpr);
+    QJsonObject params;
+    params[QStringLiteral("radius")] = deviceRadius;
+
+    int sink = 0;
+    m_recorder.measure(QStringLiteral("computeBoxSizes"), params, [&] {
+        sink += BoxShadowHelper::computeBoxSizes(deviceRadius, BoxShadowHelper::NUM_BOX_BLUR_PASSES).first();
+    });
+    m_recorder.measure(QStringLiteral("boxSizes"), params, [&] {
+        sink += BoxShadowHelper::boxSizes(deviceRadius).sizes[0];
+    });
+    QVERIFY(sink > 0);
+}
+
+void ShadowBench::boxBlurPass_data()
+{
+    addPresetRows(false);
+}
+
+void ShadowBench::boxBlurPass()
+{
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const QImage src = boxMask(radius, dpr);
+    QImage dst(src.height(), src.width(), QImage::Format_Alpha8);
+    const int boxSize = BoxShadowHelper::boxSizes(qRound(radius * dpr)).sizes[0];
+
+    QJsonObject params;
+    params[QStringLiteral("width")] = src.width();
+    params[QStringLiteral("height")] = src.height();
+    params[QStringLiteral("boxSize")] = boxSize;
+
+    m_recorder.measure(QStringLiteral("boxBlurPass"), params, [&] {
+        BoxShadowHelper::boxBlurPass(src, dst, boxSize);
+    });
+}
+
+void ShadowBench::boxBlurAlpha_data()
+{
+    addPresetRows(false);
+}
+
+void ShadowBench::boxBlurAlpha()
+{
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    // Blurring in place keeps spreading the same box, which costs the same
+    // as blurring a fresh copy every time.
+    QImage image = boxMask(radius, dpr);
+    const int deviceRadius = qRound(radius * dpr);
+
+    QJsonObject params;
+    params[QStringLiteral("width")] = image.width();
+    params[QStringLiteral("height")] = image.height();
+    params[QStringLiteral("radius")] = deviceRadius;
+
+    m_recorder.measure(QStringLiteral("boxBlurAlpha"), params, [&] {
+        BoxShadowHelper::boxBlurAlpha(image, deviceRadius);
+    });
+}
+
+void ShadowBench::shadowTexture_data()
+{
+    addPresetRows(true);
+}
+
+void ShadowBench::shadowTexture()
+{
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+    QFETCH(int, method);
+
+    // What a cache miss in Decoration::updateShadow renders.
+    ShadowKey key;
+    key.color = QColor(33, 33, 33);
+    key.radius = radius;
+    key.method = method;
+    key.devicePixelRatio = dpr;
+
+    const QImage texture = ShadowCache::render(key);
+    QVERIFY(!texture.isNull());
+    QCOMPARE(texture.size(), QSize(4 * radius + 1, 4 * radius + 1) * dpr);
+
+    QJsonObject params;
+    params[QStringLiteral("radius")] = radius;
+    params[QStringLiteral("dpr")] = dpr;
+    params[QStringLiteral("method")] = method == InternalSettings::ShadowBoxBlur
+        ? QStringLiteral("boxblur")
+        : QStringLiteral("analytic");
+    params[QStringLiteral("width")] = texture.width();
+
+    // The analytic method has to stay interchangeable with the box blur.
+    if (method == InternalSettings::ShadowAnalytic) {
+        ShadowKey boxBlurKey = key;
+        boxBlurKey.method = InternalSettings::ShadowBoxBlur;
+        const QImage boxBlur = ShadowCache::render(boxBlurKey);
+        QCOMPARE(boxBlur.size(), texture.size());
+        const int difference = maxAlphaDifference(boxBlur, texture);
+        QVERIFY2(difference <= MAX_ANALYTIC_ERROR,
+            qPrintable(QStringLiteral("alpha differs by %1 from the box blur").arg(difference)));
+        params[QStringLiteral("maxAlphaDifference")] = difference;
+    }
+
+    m_recorder.measure(QStringLiteral("shadowTexture"), params, [&] {
+        ShadowCache::render(key);
+    });
+}
+
+void ShadowBench::reducedResolution_data()
+{
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+    QTest::addColumn<int>("resolution");
+
+    const int resolutions[] = { InternalSettings::ShadowHalfResolution, InternalSettings::ShadowQuarterResolution };
+    for (const Preset &preset : s_presets) {
+        const int radius = shadowRadius(preset.sizePreset, 0);
+        for (const qreal dpr : s_devicePixelRatios) {
+            for (const int resolution : resolutions) {
+                const QByteArray tag = QStringLiteral("%1@%2/%3")
+                    .arg(QLatin1String(preset.name))
+                    .arg(dpr)
+                    .arg(resolution == InternalSettings::ShadowHalfResolution ? QStringLiteral("half") : QStringLiteral("quarter"))
+                    .toLatin1();
+                QTest::newRow(tag.constData()) << radius << dpr << resolution;
+            }
+        }
+    }
+}
+
+void ShadowBench::reducedResolution()
+{
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+    QFETCH(int, resolution);
+
+    ShadowKey key;
+    key.color = QColor(33, 33, 33);
+    key.radius = radius;
+    key.method = InternalSettings::ShadowBoxBlur;
+    key.devicePixelRatio = dpr;
+    const QImage full = ShadowCache::render(key);
+
+    key.downscale = shadowDownscale(resolution, radius, dpr);
+    const QImage reduced = ShadowCache::render(key);
+
+    QCOMPARE(reduced.size(), full.size());
+    const int difference = maxAlphaDifference(full, reduced);
+    QVERIFY2(difference <= MAX_REDUCED_RESOLUTION_ERROR,
+        qPrintable(QStringLiteral("alpha differs by %1 at downscale %2").arg(difference).arg(key.downscale)));
+
+    QJsonObject params;
+    params[QStringLiteral("radius")] = radius;
+    params[QStringLiteral("dpr")] = dpr;
+    params[QStringLiteral("downscale")] = key.downscale;
+    params[QStringLiteral("maxAlphaDifference")] = difference;
+
+    m_recorder.measure(QStringLiteral("reducedResolution"), params, [&] {
+        ShadowCache::render(key);
+    });
+}
+
+void ShadowBench::cleanupTestCase()
+{
+    QJsonObject root;
+    root[QStringLiteral("benchmark")] = QStringLiteral("shadowbench");
+    root[QStringLiteral("implementation")] = QString::fromLatin1(
+        ShadowKernels::implementationName(ShadowKernels::implementation()));
+    root[QStringLiteral("idealThreadCount")] = QThread::idealThreadCount();
+    QVERIFY2(m_recorder.write(m_jsonPath, root), qPrintable(m_jsonPath));
+}
+
+int main(int argc, char **argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    ShadowBench bench(BenchmarkRecorder::takeJsonPath(args, QStringLiteral("shadowbench.json")));
+    return QTest::qExec(&bench, args);
+}
+
+#include "ShadowBench.moc"
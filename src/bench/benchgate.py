@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2020 Chris Holland <zrenfire@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Runs the benchmarks several times and compares them with a baseline.
+
+    benchgate.py --bin-dir build/src/bench [--runs 5] [--threshold 10]
+    benchgate.py --bin-dir build/src/bench --update-baseline
+    benchgate.py --bin-dir build/src/bench --skip-without-baseline
+
+Every measurement is reduced to the median of its per-run medians, with the
+median absolute deviation (MAD) as its noise. A measurement regresses when
+it is slower than the baseline by more than the threshold and by more than
+--noise times the larger MAD of the two, so that a noisy machine does not
+fail the gate on its own. Allocation counts reported by decobench are
+compared against the same threshold.
+
+Exits with 0 when nothing regressed, 1 on a regression, 2 when a
+benchmark could not be run and 3 when there is no baseline to compare a
+benchmark with. With --skip-without-baseline a missing baseline only
+prints the command that records one and exits with 0, which is what the
+benchgate build target does so that a fresh checkout still builds.
+"""
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+
+BASELINE_VERSION = 1
+
+BENCHMARKS = ("shadowbench", "decobench")
+
+DEFAULT_BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "baseline.json")
+
+# Fields of a result that describe the machine rather than a measurement.
+ENVIRONMENT_FIELDS = ("qtVersion", "implementation", "idealThreadCount")
+
+
+class BenchError(Exception):
+    pass
+
+
+def median_and_mad(values):
+    median = statistics.median(values)
+    mad = statistics.median(abs(value - median) for value in values)
+    return median, mad
+
+
+def result_key(result):
+    return "%s/%s" % (result["name"], result["case"])
+
+
+def run_benchmark(path, runs):
+    """Returns the per-run results of one benchmark executable."""
+    if not os.access(path, os.X_OK):
+        raise BenchError("%s is not an executable, build with -DBUILD_BENCHMARKS=ON" % path)
+
+    outputs = []
+    with tempfile.TemporaryDirectory(prefix="benchgate-") as directory:
+        for run in range(runs):
+            json_path = os.path.join(directory, "run%d.json" % run)
+            print("%s: run %d/%d" % (os.path.basename(path), run + 1, runs), file=sys.stderr)
+            process = subprocess.run(
+                [path, "-json", json_path, "-silent"],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT,
+                universal_newlines=True,
+            )
+            if process.returncode != 0:
+                raise BenchError("%s failed with exit code %d:\n%s" % (path, process.returncode, process.stdout))
+            with open(json_path) as file:
+                outputs.append(json.load(file))
+    return outputs
+
+
+def summarize(outputs):
+    """Reduces the runs of one benchmark to one entry per measurement."""
+    samples = {}
+    for output in outputs:
+        seen = set()
+        for result in output["results"]:
+            key = result_key(result)
+            if key in seen:
+                raise BenchError("%s is measured twice in one run" % key)
+            seen.add(key)
+            entry = samples.setdefault(key, {"median_ns": [], "allocations": []})
+            entry["median_ns"].append(result["median_ns"])
+            if "allocations" in result:
+                entry["allocations"].append(result["allocations"])
+
+    measurements = {}
+    for key, entry in samples.items():
+        median, mad = median_and_mad(entry["median_ns"])
+        measurement = {
+            "runs": len(entry["median_ns"]),
+            "median_ns": median,
+            "mad_ns": mad,
+        }
+        if entry["allocations"]:
+            measurement["allocations"] = statistics.median(entry["allocations"])
+        measurements[key] = measurement
+
+    environment = {field: outputs[0][field] for field in ENVIRONMENT_FIELDS if field in outputs[0]}
+    environment["machine"] = platform.machine()
+    return {"environment": environment, "measurements": measurements}
+
+
+def relative_delta(baseline, current):
+    if baseline == 0:
+        return 0.0 if current == 0 else float("inf")
+    return (current - baseline) / baseline * 100
+
+
+def format_ns(value):
+    if value >= 1e6:
+        return "%.3f ms" % (value / 1e6)
+    return "%.1f us" % (value / 1e3)
+
+
+def compare(name, baseline, current, threshold, noise):
+    """Prints the delta report of one benchmark, returns the regressions."""
+    regressions = []
+    rows = []
+
+    for field, value in current["environment"].items():
+        if baseline["environment"].get(field) != value:
+            print("\n%s: warning: %s is %s, the baseline was recorded with %s"
+                  % (name, field, value, baseline["environment"].get(field)))
+
+    baseline_measurements = baseline["measurements"]
+    for key in sorted(set(baseline_measurements) | set(current["measurements"])):
+        old = baseline_measurements.get(key)
+        new = current["measurements"].get(key)
+        if old is None:
+            rows.append((key, "-", format_ns(new["median_ns"]), "-", "new", ""))
+            continue
+        if new is None:
+            rows.append((key, format_ns(old["median_ns"]), "-", "-", "missing", ""))
+            continue
+
+        delta = relative_delta(old["median_ns"], new["median_ns"])
+        allowed = noise * max(old["mad_ns"], new["mad_ns"])
+        status = "ok"
+        note = ""
+        if delta > threshold and new["median_ns"] - old["median_ns"] > allowed:
+            status = "SLOWER"
+        elif delta < -threshold and old["median_ns"] - new["median_ns"] > allowed:
+            status = "faster"
+
+        if "allocations" in old and "allocations" in new:
+            allocation_delta = relative_delta(old["allocations"], new["allocations"])
+            if allocation_delta > threshold:
+                status = "SLOWER" if status == "SLOWER" else "ALLOCATES"
+                note = "allocations %d -> %d" % (old["allocations"], new["allocations"])
+
+        if status in ("SLOWER", "ALLOCATES"):
+            regressions.append("%s/%s" % (name, key))
+        rows.append((key, format_ns(old["median_ns"]), format_ns(new["median_ns"]),
+                     "%+.1f%% (MAD %s)" % (delta, format_ns(max(old["mad_ns"], new["mad_ns"]))), status, note))
+
+    header = ("measurement", "baseline", "current", "delta", "status", "note")
+    widths = [max(len(row[column]) for row in rows + [header]) for column in range(len(header))]
+    print("\n%s:" % name)
+    for row in [header] + rows:
+        print("  " + "  ".join(cell.ljust(width) for cell, width in zip(row, widths)).rstrip())
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bin-dir", default=".",
+                        help="directory containing the benchmark executables")
+    parser.add_argument("--benchmark", action="append", choices=BENCHMARKS,
+                        help="benchmark to run, may be repeated (default: all)")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE,
+                        help="baseline JSON (default: %(default)s)")
+    parser.add_argument("--runs", type=int, default=5,
+                        help="runs of every benchmark (default: %(default)s)")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default: %(default)s)")
+    parser.add_argument("--noise", type=float, default=3.0,
+                        help="MADs a slowdown has to exceed as well (default: %(default)s)")
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="record the results as the new baseline instead of comparing")
+    parser.add_argument("--skip-without-baseline", action="store_true",
+                        help="print how to record a missing baseline and exit with 0 instead of 3")
+    args = parser.parse_args()
+
+    if args.runs < 3:
+        parser.error("--runs has to be at least 3 for the MAD to mean anything")
+
+    try:
+        with open(args.baseline) as file:
+            baseline = json.load(file)
+    except FileNotFoundError:
+        baseline = {"version": BASELINE_VERSION, "benchmarks": {}}
+    if baseline.get("version") != BASELINE_VERSION:
+        print("%s: unsupported baseline version %s" % (args.baseline, baseline.get("version")), file=sys.stderr)
+        return 2
+
+    # Without a baseline the gate could never fail, so that is an error of
+    # its own rather than a pass.
+    names = args.benchmark or BENCHMARKS
+    missing = [name for name in names if name not in baseline["benchmarks"]]
+    if missing and not args.update_baseline:
+        print("%s: no baseline for %s, record one on the reference machine with:\n  %s --bin-dir %s --update-baseline"
+              % (args.baseline, ", ".join(missing), sys.argv[0], args.bin_dir), file=sys.stderr)
+        return 0 if args.skip_without_baseline else 3
+
+    regressions = []
+    try:
+        for name in names:
+            current = summarize(run_benchmark(os.path.join(args.bin_dir, name), args.runs))
+            if args.update_baseline:
+                baseline["benchmarks"][name] = current
+            else:
+                regressions += compare(name, baseline["benchmarks"][name], current,
+                                       args.threshold, args.noise)
+    except BenchError as error:
+        print(error, file=sys.stderr)
+        return 2
+
+    if args.update_baseline:
+        with open(args.baseline, "w") as file:
+            json.dump(baseline, file, indent=4, sort_keys=True)
+            file.write("\n")
+        print("Baseline written to %s" % args.baseline)
+        return 0
+
+    if regressions:
+        print("\n%d regression(s) over %.1f%%:" % (len(regressions), args.threshold))
+        for regression in regressions:
+            print("  " + regression)
+        return 1
+    print("\nNo regressions over %.1f%%." % args.threshold)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())